@@ -178,6 +178,7 @@ ReadCommandLineArgs() #{{{
       -r|ReconstructionOnly*) Script[reconstructionOnly]=true;;
       -f|ForwardProjectionSimulation*) Script[CBCTforwardProjectionSimulation]=true;;
       -d|NoDisplay*) Script[noDisplay]=true;;
+      -l|LazyOrientation*) Script[lazyOrientation]=true;; # final images: orientation in the header (TransformMatrix)
       RemoteHosts=*) Script[remoteHosts]="$(GetArg "$arg" STRINGADD "${Script[remoteHosts]}")";;
       CpuCores=*) Script[cpuCores]="$(GetArg "$arg" INT ">0")";;
       Modality=*) Script[modality]="$(GetArg "$arg" STRING "${modalities[*]}")";;
@@ -286,6 +287,8 @@ ReadCommandLineArgs() #{{{
       PhantomCropMinZ=*) Phantom[cropMinZ]="$(GetArg "$arg" INT ">0")";;
       PhantomCropMaxZ=*) Phantom[cropMaxZ]="$(GetArg "$arg" INT ">0")";;
       PhantomRotateXdeg=*) Phantom[rotateXdeg]="$(GetArg "$arg" FLOAT)";;
+      PhantomPyramidLevel=*) Phantom[pyramidLevel]="$(GetArg "$arg" INT ">=0")";;
+      PhantomTrim*) Phantom[trim]=true;; # trim the air/vacuum margins of the atlas before Gate (trim-mhd)
       TumorCellsMhdFile=*) Tumor[cellsMhdFile]="$(GetArg "$arg" FILEIN)";;
       TumorShiftXmm=*) Tumor[shiftXmm]="$(GetArg "$arg" FLOAT)";;
       TumorShiftYmm=*) Tumor[shiftYmm]="$(GetArg "$arg" FLOAT)";;
@@ -562,6 +565,10 @@ CheckPhantomVars() #{{{
   : "${Phantom[shiftYmm]:=0.0}"
   : "${Phantom[shiftZmm]:=0.0}"
   : "${Phantom[rotateXdeg]:=0.0}"
+  : "${Phantom[pyramidLevel]:=0}"
+  : "${Phantom[trimShiftXmm]:=0.0}" # centre of the trimmed atlas relative to the untrimmed one (trim-mhd)
+  : "${Phantom[trimShiftYmm]:=0.0}"
+  : "${Phantom[trimShiftZmm]:=0.0}"
   } #}}}
 
 CheckTumorVars() #{{{
@@ -628,32 +635,38 @@ CheckRemoteHosts() #{{{
 CropMhdPhantomZ() #{{{
   {
   EchoBlLog "${FUNCNAME[0]}() ..."
-  if [[ "$(awk '$1~/^ElementType/{print $3}' "${Phantom[atlasMhdFile]}")" =~ MET_UCHAR ]]; then 
-    local -i bytesPerVoxel=1
-  else 
-    local -i bytesPerVoxel=2; fi
-  local -i dimX=$(awk '$1~/^DimSize/{print $3}' "${Phantom[atlasMhdFile]}")
-  local -i dimY=$(awk '$1~/^DimSize/{print $4}' "${Phantom[atlasMhdFile]}")
-  local -i croppedDimZ=$(Bci "${Phantom[cropMaxZ]} - ${Phantom[cropMinZ]} + 1")
-  local -i bytesPerSliceZ=$(Bci "$dimX * $dimY * $bytesPerVoxel")
-  local -i headBytes=$(Bci "${Phantom[cropMinZ]} * $bytesPerSliceZ")
-  local -i copyBytes=$(Bci "$croppedDimZ * $bytesPerSliceZ")
-  local file="${Phantom[atlasMhdFile]%.*}-cropped"
-  dd if="${Phantom[atlasMhdFile]%.*}.raw" of="$file.raw" bs=1 skip="$headBytes" count="$copyBytes" status=noxfer
-  cp "${Phantom[atlasMhdFile]}" "$file.mhd"
-  gawk -i inplace -v var="$croppedDimZ" '$1~/^DimSize/{$5=var}1' "$file.mhd"
-  gawk -i inplace -v var="$file.raw" '$1~/^ElementDataFile/{$3=var}1' "$file.mhd"
-  Phantom[atlasMhdFile]="$file.mhd"
+  # a z-range is not copied: the cropped header refers to the atlas raw file (HeaderSize skips the slices below)
+  Phantom[atlasMhdFile]=$("${Script[toolsDir]}"/crop-mhd "${Phantom[atlasMhdFile]}" "z=${Phantom[cropMinZ]}:${Phantom[cropMaxZ]}")
   } #}}}
 
 FetchPhantomFilesAndPreprocess() #{{{
   {
   EchoBlLog "${FUNCNAME[0]}() ..."
   if [[ -v Phantom[atlasMhdFile] ]]; then
-    [[ "$(awk '$1~/^ElementType/{print $3}' "${Phantom[atlasMhdFile]}")" =~ MET_UCHAR|MET_USHORT ]] ||
+    eval "$("${Script[toolsDir]}"/mhd-info "${Phantom[atlasMhdFile]}" -p atlas)"
+    [[ "$atlasElementType" =~ MET_UCHAR|MET_USHORT ]] ||
       EchoErr "${Phantom[atlasMhdFile]} is not of type MET_UCHAR or MET_USHORT"
-    cp "${Phantom[atlasMhdFile]}" .
-    cp "$(dirname -- "${Phantom[atlasMhdFile]}")/$(awk '$1~/^ElementDataFile/{print $3}' "${Phantom[atlasMhdFile]}")" .
+    [[ "$atlasElementDataFile" != LOCAL ]] ||
+      EchoErr "${Phantom[atlasMhdFile]} holds its data (ElementDataFile = LOCAL), which the tools cannot read"
+    if (( Phantom[pyramidLevel] > 0 )); then
+      # Preview run on a coarser atlas (majority vote per 2^level block); the pyramid is built next to the atlas
+      # (if writable, else here) and reused by later runs
+      EchoGnLog "create-label-pyramid-mhd ..."
+      local atlasDir=$(dirname -- "${Phantom[atlasMhdFile]}")
+      if [[ ! -w "$atlasDir" ]]; then
+        cp "${Phantom[atlasMhdFile]}" "${atlasElementDataPaths[@]}" . # all data files, also of a LIST atlas
+        atlasDir=.
+      fi
+      local -a levelFiles
+      mapfile -t levelFiles < <(cd "$atlasDir" && "${Script[toolsDir]}"/create-label-pyramid-mhd "$(basename -- "${Phantom[atlasMhdFile]}")" "${Phantom[pyramidLevel]}")
+      (( ${#levelFiles[@]} == Phantom[pyramidLevel] )) || EchoErr "create-label-pyramid-mhd failed for ${Phantom[atlasMhdFile]}"
+      Phantom[atlasMhdFile]="$atlasDir/${levelFiles[-1]}"
+      eval "$("${Script[toolsDir]}"/mhd-info "${Phantom[atlasMhdFile]}" -p atlas)"
+    fi
+    if [[ "$(dirname -- "${Phantom[atlasMhdFile]}")" != . ]]; then
+      cp "${Phantom[atlasMhdFile]}" .
+      cp "${atlasElementDataPaths[@]}" .
+    fi
     Phantom[atlasMhdFile]=$(basename -- "${Phantom[atlasMhdFile]}")
     # If CBCT tilt the phantom
     [[ -v Script[usesGate] && "${Script[modality]}" =~ CBCT ]] && Phantom[atlasMhdFile]=$("${Script[toolsDir]}"/tilt-mhd "${Phantom[atlasMhdFile]}" +y)
@@ -672,15 +685,16 @@ FetchPhantomFilesAndPreprocess() #{{{
     fi
     if [[ -v Tumor[cellsMhdFile] ]]; then
       # Fetch tumor cells insert mhd/raw files
-      [[ "$(awk '$1~/^ElementType/{print $3}' "${Tumor[cellsMhdFile]}")" =~ MET_UCHAR|MET_USHORT ]] ||
+      eval "$("${Script[toolsDir]}"/mhd-info "${Tumor[cellsMhdFile]}" -p tumor)"
+      [[ "$tumorElementType" =~ MET_UCHAR|MET_USHORT ]] ||
         EchoErr "${Tumor[cellsMhdFile]} is not of type MET_UCHAR or MET_USHORT"
       cp "${Tumor[cellsMhdFile]}" .
-      cp "$(dirname -- "${Tumor[cellsMhdFile]}")/$(awk '$1~/^ElementDataFile/{print $3}' "${Tumor[cellsMhdFile]}")" .
+      cp "$tumorElementDataPath" .
       Tumor[cellsMhdFile]=$(basename -- "${Tumor[cellsMhdFile]}")
       # Down-sample tumor cells to phantom atlas resolution
       EchoGnLog "create-downsampled-tumor-mhd ..."
-      # shellcheck disable=SC2046
-      local tumorMhdFile=$("${Script[toolsDir]}"/create-downsampled-tumor-mhd "${Tumor[cellsMhdFile]}" "${Tumor[cellDiametermm]}" $(awk '$1~/^ElementSize/{print $3, $4, $5}' "${Phantom[atlasMhdFile]}"))
+      eval "$("${Script[toolsDir]}"/mhd-info "${Phantom[atlasMhdFile]}" -p atlas)" # the atlas may have been tilted
+      local tumorMhdFile=$("${Script[toolsDir]}"/create-downsampled-tumor-mhd "${Tumor[cellsMhdFile]}" "${Tumor[cellDiametermm]}" "${atlasElementSize[@]}")
       # Add tumor cells insert into phantom atlas
       EchoGnLog "add-tumor-mhd-into-phantom-mhd ..."
       local returnStr=$("${Script[toolsDir]}"/add-tumor-mhd-into-phantom-mhd -a "${Phantom[atlasMhdFile]}" -t "$tumorMhdFile" -o "${Tumor[shiftXmm]},${Tumor[shiftYmm]},${Tumor[shiftZmm]}")
@@ -689,7 +703,8 @@ FetchPhantomFilesAndPreprocess() #{{{
       local -i tumorLabelMin="${returnArray[1]}"
       local -i tumorLabelMax="${returnArray[2]}"
       [[ -f "${Phantom[atlasMhdFile]}" ]] || EchoErr "add-tumor-mhd-into-phantom-mhd returned '${Phantom[atlasMhdFile]}'"
-      [[ "$(awk '$1~/^ElementType/{print $3}' "${Phantom[atlasMhdFile]}")" =~ MET_UCHAR|MET_USHORT ]] ||
+      eval "$("${Script[toolsDir]}"/mhd-info "${Phantom[atlasMhdFile]}" -p atlas)"
+      [[ "$atlasElementType" =~ MET_UCHAR|MET_USHORT ]] ||
         EchoErr "${Phantom[atlasMhdFile]} (after adding tumor insert) is not of type MET_UCHAR or MET_USHORT"
       if [[ -v Script[usesGate] ]]; then
         # Modify material and source files; the label value in tumorMhdFile corresponds to number of cells per voxel
@@ -724,6 +739,32 @@ FetchPhantomFilesAndPreprocess() #{{{
       fi
     fi
     [[ -v Phantom[cropMinZ] || -v Phantom[cropMaxZ] ]] && CropMhdPhantomZ
+    # Air/vacuum label ranges of the phantom (<min>:<max>), the background for rotate-mhd and trim-mhd
+    local -a backgroundLabels=()
+    if [[ -v Phantom[materialsDatFile] ]]; then
+      backgroundLabels=($(awk 'NR > 1 && $3 ~ /^(Air|Vacuum|G4_AIR|G4_Galactic)$/ { print $1 ":" $2 }' "${Phantom[materialsDatFile]}"))
+    fi
+    # Pre-rotate the phantom, so Gate navigates an unrotated voxel volume (a rotated parametrised volume is slow);
+    # the corners outside the atlas get an air/vacuum label, as they were the world (Air) when Gate rotated it
+    if [[ -v Script[usesGate] ]] && (( $(echo "${Phantom[rotateXdeg]} != 0" | bc) )); then
+      (( ${#backgroundLabels[@]} > 0 )) || EchoErr "Phantom[rotateXdeg] needs an Air/Vacuum label in Phantom[materialsDatFile] for the corners of the rotated phantom"
+      EchoGnLog "rotate-mhd ..."
+      Phantom[atlasMhdFile]=$("${Script[toolsDir]}"/rotate-mhd -b "${backgroundLabels[0]%%:*}" "${Phantom[atlasMhdFile]}" "${Phantom[rotateXdeg]}")
+    fi
+    # PhantomTrim: trim the air/vacuum margins, so Gate builds and navigates (and the MuMap/SourceMap actors 
+    # allocate) only the phantom box; the box is centred (-c), so the CASToR FOV and the CBCT rotation stay centred
+    # on the phantom. Off by default, since it changes the atlas, MuMap/SourceMap and FOV dimensions.
+    if [[ -v Phantom[trim] && -v Script[usesGate] ]]; then
+      (( ${#backgroundLabels[@]} > 0 )) || EchoErr "PhantomTrim needs an Air/Vacuum label in Phantom[materialsDatFile]"
+      EchoGnLog "trim-mhd ..."
+      local returnStr=$("${Script[toolsDir]}"/trim-mhd -c "${Phantom[atlasMhdFile]}" "${backgroundLabels[@]}")
+      IFS=" " read -r -a returnArray <<< "$returnStr"
+      [[ -f "${returnArray[0]}" ]] || EchoErr "trim-mhd returned '$returnStr'"
+      Phantom[atlasMhdFile]="${returnArray[0]}"
+      Phantom[trimShiftXmm]="${returnArray[1]}"
+      Phantom[trimShiftYmm]="${returnArray[2]}"
+      Phantom[trimShiftZmm]="${returnArray[3]}"
+    fi
     if [[ -v Phantom[activitiesDatFile] ]]; then
       # Scale activity into absolute values
       Phantom[scaledActivitiesDatFile]="${Phantom[activitiesDatFile]%.*}-scaled.dat"
@@ -756,14 +797,16 @@ FetchPhantomFilesAndPreprocess() #{{{
     fi
     if [[ -v Tumor[cellsMhdFile] ]]; then
       # Fetch tumor cells insert mhd/raw files
-      [[ "$(awk '$1~/^ElementType/{print $3}' "${Tumor[cellsMhdFile]}")" =~ MET_UCHAR|MET_USHORT ]] ||
+      eval "$("${Script[toolsDir]}"/mhd-info "${Tumor[cellsMhdFile]}" -p tumor)"
+      [[ "$tumorElementType" =~ MET_UCHAR|MET_USHORT ]] ||
         EchoErr "${Tumor[cellsMhdFile]} is not of type MET_UCHAR or MET_USHORT"
       cp "${Tumor[cellsMhdFile]}" .
-      cp "$(dirname -- "${Tumor[cellsMhdFile]}")/$(awk '$1~/^ElementDataFile/{print $3}' "${Tumor[cellsMhdFile]}")" .
+      cp "$tumorElementDataPath" .
       Tumor[cellsMhdFile]=$(basename -- "${Tumor[cellsMhdFile]}")
       # reassign ElementSize depending on TumorCellDiametermm
-      sed -i "s/^ElementSize.*/ElementSize = ${Tumor[cellDiametermm]} ${Tumor[cellDiametermm]} ${Tumor[cellDiametermm]}/" "${Tumor[cellsMhdFile]}"
-      sed -i "s/^ElementSpacing.*/ElementSpacing = ${Tumor[cellDiametermm]} ${Tumor[cellDiametermm]} ${Tumor[cellDiametermm]}/" "${Tumor[cellsMhdFile]}"
+      "${Script[toolsDir]}"/mhd-edit "${Tumor[cellsMhdFile]}" \
+        "ElementSize=${Tumor[cellDiametermm]} ${Tumor[cellDiametermm]} ${Tumor[cellDiametermm]}" \
+        "ElementSpacing=${Tumor[cellDiametermm]} ${Tumor[cellDiametermm]} ${Tumor[cellDiametermm]}"
     fi
     # Generate ini file for lipros
     # TODO: this reads just the skin mesh, no other internal organ meshs, and assigns muscle tissue to it
@@ -1216,12 +1259,9 @@ EchoGateCBCTScanner() #{{{
 
 EchoGatePhantom() #{{{
   {
-  local -i dimX=$(awk '$1~/^DimSize/{print $3}' "${Phantom[atlasMhdFile]}")
-  local -i dimY=$(awk '$1~/^DimSize/{print $4}' "${Phantom[atlasMhdFile]}")
-  local -i dimZ=$(awk '$1~/^DimSize/{print $5}' "${Phantom[atlasMhdFile]}")
-  local sizeX=$(awk '$1~/^ElementSize/{print $3}' "${Phantom[atlasMhdFile]}")
-  local sizeY=$(awk '$1~/^ElementSize/{print $4}' "${Phantom[atlasMhdFile]}")
-  local sizeZ=$(awk '$1~/^ElementSize/{print $5}' "${Phantom[atlasMhdFile]}")
+  eval "$("${Script[toolsDir]}"/mhd-info "${Phantom[atlasMhdFile]}")"
+  local -i dimX=${DimSize[0]} dimY=${DimSize[1]} dimZ=${DimSize[2]}
+  local sizeX=${ElementSize[0]} sizeY=${ElementSize[1]} sizeZ=${ElementSize[2]}
   local halfSizeX=$(Bcf "0.5 * $dimX * $sizeX")
   local halfSizeY=$(Bcf "0.5 * $dimY * $sizeY")
   local halfSizeZ=$(Bcf "0.5 * $dimZ * $sizeZ")
@@ -1236,9 +1276,11 @@ EchoGatePhantom() #{{{
   fi
   echo "/gate/myPhantom/geometry/setImage               ${Phantom[atlasMhdFile]}"
   echo "/gate/myPhantom/geometry/setRangeToMaterialFile ${Phantom[materialsDatFile]}"
-  echo "/gate/myPhantom/placement/setTranslation        ${Phantom[shiftXmm]} ${Phantom[shiftYmm]} ${Phantom[shiftZmm]} mm"
-  echo "/gate/myPhantom/placement/setRotationAxis       1 0 0"
-  echo "/gate/myPhantom/placement/setRotationAngle      ${Phantom[rotateXdeg]} deg"
+  local translationX=$(Bcf "${Phantom[shiftXmm]} + ${Phantom[trimShiftXmm]}")
+  local translationY=$(Bcf "${Phantom[shiftYmm]} + ${Phantom[trimShiftYmm]}")
+  local translationZ=$(Bcf "${Phantom[shiftZmm]} + ${Phantom[trimShiftZmm]}")
+  echo "/gate/myPhantom/placement/setTranslation        $translationX $translationY $translationZ mm"
+  # no placement rotation: PhantomRotateXdeg has been applied to the atlas by rotate-mhd
   if [[ "${Script[modality]}" =~ CBCT ]]; then
     echo "# Rotate phantom for CT data acquisition"
     echo "/gate/myPhantom/moves/insert                  rotation"
@@ -1262,12 +1304,9 @@ EchoGatePhysics() #{{{
 
 EchoGateActors() #{{{
   {
-  local -i dimX=$(awk '$1~/^DimSize/{print $3}' "${Phantom[atlasMhdFile]}")
-  local -i dimY=$(awk '$1~/^DimSize/{print $4}' "${Phantom[atlasMhdFile]}")
-  local -i dimZ=$(awk '$1~/^DimSize/{print $5}' "${Phantom[atlasMhdFile]}")
-  local sizeX=$(awk '$1~/^ElementSize/{print $3}' "${Phantom[atlasMhdFile]}")
-  local sizeY=$(awk '$1~/^ElementSize/{print $4}' "${Phantom[atlasMhdFile]}")
-  local sizeZ=$(awk '$1~/^ElementSize/{print $5}' "${Phantom[atlasMhdFile]}")
+  eval "$("${Script[toolsDir]}"/mhd-info "${Phantom[atlasMhdFile]}")"
+  local -i dimX=${DimSize[0]} dimY=${DimSize[1]} dimZ=${DimSize[2]}
+  local sizeX=${ElementSize[0]} sizeY=${ElementSize[1]} sizeZ=${ElementSize[2]}
   echo "# 7. A C T O R S"
   echo "/gate/actor/addActor   SimulationStatisticActor stat"
   echo "/gate/actor/stat/save  Gate-statistics.txt"
@@ -1369,12 +1408,9 @@ EchoGateCBCTDigitizer() #{{{
 
 EchoGateSPECTSource() #{{{
   {
-  local -i dimX=$(awk '$1~/^DimSize/{print $3}' "${Phantom[atlasMhdFile]}")
-  local -i dimY=$(awk '$1~/^DimSize/{print $4}' "${Phantom[atlasMhdFile]}")
-  local -i dimZ=$(awk '$1~/^DimSize/{print $5}' "${Phantom[atlasMhdFile]}")
-  local sizeX=$(awk '$1~/^ElementSize/{print $3}' "${Phantom[atlasMhdFile]}")
-  local sizeY=$(awk '$1~/^ElementSize/{print $4}' "${Phantom[atlasMhdFile]}")
-  local sizeZ=$(awk '$1~/^ElementSize/{print $5}' "${Phantom[atlasMhdFile]}")
+  eval "$("${Script[toolsDir]}"/mhd-info "${Phantom[atlasMhdFile]}")"
+  local -i dimX=${DimSize[0]} dimY=${DimSize[1]} dimZ=${DimSize[2]}
+  local sizeX=${ElementSize[0]} sizeY=${ElementSize[1]} sizeZ=${ElementSize[2]}
   local halfSizeX=$(Bcf "0.5 * $dimX * $sizeX")
   local halfSizeY=$(Bcf "0.5 * $dimY * $sizeY")
   local halfSizeZ=$(Bcf "0.5 * $dimZ * $sizeZ")
@@ -1386,7 +1422,7 @@ EchoGateSPECTSource() #{{{
   echo "/gate/source/mySource/imageReader/rangeTranslator/describe  1"
   echo "/gate/source/mySource/imageReader/readFile                  ${Phantom[atlasMhdFile]}"
   echo "/gate/source/mySource/imageReader/verbose                   1"
-  echo "/gate/source/mySource/setPosition                           -$halfSizeX -$halfSizeY -$halfSizeZ mm"
+  echo "/gate/source/mySource/setPosition                           $(Bcf "${Phantom[trimShiftXmm]} - $halfSizeX") $(Bcf "${Phantom[trimShiftYmm]} - $halfSizeY") $(Bcf "${Phantom[trimShiftZmm]} - $halfSizeZ") mm"
   echo "/gate/source/mySource/gps/particle                          gamma"
   echo "/gate/source/mySource/gps/energy                            ${SPECT[isotopeEnergyKeV]} keV"
   echo "/gate/source/mySource/gps/angtype                           iso"
@@ -1397,12 +1433,9 @@ EchoGateSPECTSource() #{{{
 
 EchoGatePETSource() #{{{
   {
-  local -i dimX=$(awk '$1~/^DimSize/{print $3}' "${Phantom[atlasMhdFile]}")
-  local -i dimY=$(awk '$1~/^DimSize/{print $4}' "${Phantom[atlasMhdFile]}")
-  local -i dimZ=$(awk '$1~/^DimSize/{print $5}' "${Phantom[atlasMhdFile]}")
-  local sizeX=$(awk '$1~/^ElementSize/{print $3}' "${Phantom[atlasMhdFile]}")
-  local sizeY=$(awk '$1~/^ElementSize/{print $4}' "${Phantom[atlasMhdFile]}")
-  local sizeZ=$(awk '$1~/^ElementSize/{print $5}' "${Phantom[atlasMhdFile]}")
+  eval "$("${Script[toolsDir]}"/mhd-info "${Phantom[atlasMhdFile]}")"
+  local -i dimX=${DimSize[0]} dimY=${DimSize[1]} dimZ=${DimSize[2]}
+  local sizeX=${ElementSize[0]} sizeY=${ElementSize[1]} sizeZ=${ElementSize[2]}
   local halfSizeX=$(Bcf "0.5 * $dimX * $sizeX")
   local halfSizeY=$(Bcf "0.5 * $dimY * $sizeY")
   local halfSizeZ=$(Bcf "0.5 * $dimZ * $sizeZ")
@@ -1420,7 +1453,7 @@ EchoGatePETSource() #{{{
   echo "/gate/source/mySource/imageReader/rangeTranslator/describe  1"
   echo "/gate/source/mySource/imageReader/readFile                  ${Phantom[atlasMhdFile]}"
   echo "/gate/source/mySource/imageReader/verbose                   1"
-  echo "/gate/source/mySource/setPosition                           -$halfSizeX -$halfSizeY -$halfSizeZ mm"
+  echo "/gate/source/mySource/setPosition                           $(Bcf "${Phantom[trimShiftXmm]} - $halfSizeX") $(Bcf "${Phantom[trimShiftYmm]} - $halfSizeY") $(Bcf "${Phantom[trimShiftZmm]} - $halfSizeZ") mm"
 
   echo "/gate/source/mySource/gps/particle                          e+"
   echo "/gate/source/mySource/gps/energytype                        $energyType"
@@ -1564,7 +1597,7 @@ DistributeSimulationsToRemoteHosts() #{{{
   EchoBlLog "${FUNCNAME[0]}() ..."
   # 1. Create remote script
   echo -e "#!/bin/bash\nset -euTEo pipefail\nexec 2>&1\n"                                 >  "${Script[remoteScript]}"
-  declare -pf Bcf Bci EchoRd EchoGn EchoYe EchoBl EchoErr Log EchoLog EchoGnLog EchoBlLog EchoWngLog EchoAbort GenerateThreadedGateInterfaceFiles AddThreadedRootFiles AddThreadedSinFiles MergeThreadedMuSourceMaps >> "${Script[remoteScript]}"
+  declare -pf Bcf Bci EchoRd EchoGn EchoYe EchoBl EchoErr Log EchoLog EchoGnLog EchoBlLog EchoWngLog EchoAbort GenerateThreadedGateInterfaceFiles AddThreadedRootFiles AddThreadedSinFiles MergeThreadedMuSourceMaps FinishGateMuSourceMaps >> "${Script[remoteScript]}"
   [[ "${Script[modality]}" =~ SPECT ]] && declare -pf SPECTGateMonteCarloSimulation >> "${Script[remoteScript]}"
   [[ "${Script[modality]}" =~ PET   ]] && declare -pf PETGateMonteCarloSimulation >> "${Script[remoteScript]}"
   [[ "${Script[modality]}" =~ CBCT  ]] && declare -pf CBCTGateMonteCarloSimulation >> "${Script[remoteScript]}"
@@ -1701,13 +1734,21 @@ MergeThreadedMuSourceMaps() #{{{
     fi
   done
   cp "${Phantom[atlasMhdFile]%.*}-000-SourceMap.mhd" "${Phantom[atlasMhdFile]%.*}-SourceMap.mhd"
-  sed -i "s/ElementSpacing/ElementSize/" "${Phantom[atlasMhdFile]%.*}-SourceMap.mhd"
-  sed -i "s/ElementDataFile = .*/ElementDataFile = ${Phantom[atlasMhdFile]%.*}-SourceMap.raw/" "${Phantom[atlasMhdFile]%.*}-SourceMap.mhd"
   # the *MuMap files are all identical
   cp "${Phantom[atlasMhdFile]%.*}-000-MuMap.mhd" "${Phantom[atlasMhdFile]%.*}-MuMap.mhd"
   cp "${Phantom[atlasMhdFile]%.*}-000-MuMap.raw" "${Phantom[atlasMhdFile]%.*}-MuMap.raw"
-  sed -i "s/ElementSpacing/ElementSize/" "${Phantom[atlasMhdFile]%.*}-MuMap.mhd"
-  sed -i "s/ElementDataFile = .*/ElementDataFile = ${Phantom[atlasMhdFile]%.*}-MuMap.raw/" "${Phantom[atlasMhdFile]%.*}-MuMap.mhd"
+  } #}}}
+
+FinishGateMuSourceMaps() #{{{
+  {
+  # the attenuation and source maps of the Gate actors get ElementSize (instead of ElementSpacing), their modality
+  # and their (merged) raw data file in one mhd-edit each, which keeps ElementDataFile the last key
+  local map
+  for map in MuMap:MET_MOD_CT SourceMap:MET_MOD_NM; do
+    local mhdFile="${Phantom[atlasMhdFile]%.*}-${map%%:*}.mhd"
+    eval "$("${Script[toolsDir]}"/mhd-info "$mhdFile" -p map)"
+    "${Script[toolsDir]}"/mhd-edit "$mhdFile" "Modality=${map#*:}" "ElementSize=${mapElementSize[*]}" ElementSpacing= "ElementDataFile=${mhdFile%.*}.raw"
+  done
   } #}}}
 
 AddThreadedRootFiles() #{{{
@@ -1773,12 +1814,7 @@ SPECTGateMonteCarloSimulation() #{{{
     cat ./Gate-???.log > Gate.log
     rm -f ./*-???.{log,mac,sin,hdr,mhd,root} ./*-???-{MuMap,SourceMap}.{mhd,raw}
   fi
-  if [[ -v Phantom[atlasMhdFile] ]]; then
-    # the created attenuation and source maps need some finishing
-    echo "Modality = MET_MOD_CT" >> "${Phantom[atlasMhdFile]%.*}-MuMap.mhd"
-    sed -i "s/ElementSpacing/ElementSize/" "${Phantom[atlasMhdFile]%.*}-SourceMap.mhd"
-    echo "Modality = MET_MOD_NM" >> "${Phantom[atlasMhdFile]%.*}-SourceMap.mhd"
-  fi
+  [[ -v Phantom[atlasMhdFile] ]] && FinishGateMuSourceMaps # the created attenuation and source maps need some finishing
   EchoLog "  $(Bcf "(($(date -d "$(date)" "+%s") - $(date -d "$time0" "+%s")) / 60)") min."
   } #}}}
 
@@ -1803,13 +1839,7 @@ PETGateMonteCarloSimulation() #{{{
     cat ./Gate-???.log > Gate.log
     rm -f ./*-???.{log,mac,sin,hdr,mhd,root} ./*-???-{MuMap,SourceMap}.{mhd,raw}
   fi
-  if [[ -v Phantom[atlasMhdFile] ]]; then
-    # the created attenuation and source maps need some finishing
-    echo "Modality = MET_MOD_CT" >> "${Phantom[atlasMhdFile]%.*}-MuMap.mhd"
-    sed -i "s/ElementSpacing/ElementSize/" "${Phantom[atlasMhdFile]%.*}-SourceMap.mhd"
-    echo "Modality = MET_MOD_NM" >> "${Phantom[atlasMhdFile]%.*}-SourceMap.mhd"
-    #sed -i "/^ElementSpacing/a ElementSize = $(awk '$1~/^ElementSize/{print $3}' "${Phantom[atlasMhdFile]%.*}-MuMap.mhd") $(awk '$1~/^ElementSize/{print $4}' "${Phantom[atlasMhdFile]%.*}-MuMap.mhd") $(awk '$1~/^ElementSize/{print $5}' "${Phantom[atlasMhdFile]%.*}-MuMap.mhd")" "${Phantom[atlasMhdFile]%.*}-SourceMap.mhd"
-  fi
+  [[ -v Phantom[atlasMhdFile] ]] && FinishGateMuSourceMaps # the created attenuation and source maps need some finishing
   EchoLog "  $(Bcf "(($(date -d "$(date)" "+%s") - $(date -d "$time0" "+%s")) / 60)") min."
   } #}}}
 
@@ -1865,15 +1895,14 @@ RtkCBCTforwardProjectionSimulation() #{{{
   EchoBlLog "${FUNCNAME[0]}() ..."
   local time0=$(date)
   # 1. Create phantom density map from phantom atlas
-  local phantomAtlasDensityMhdFile=$("${Script[toolsDir]}"/create-density-mhd-from-phantom-mhd "${Phantom[atlasMhdFile]}" "${Phantom[materialsDatFile]}")
+  local phantomAtlasDensityMhdFile=$("${Script[toolsDir]}"/create-density-mhd-from-phantom-mhd "${Phantom[atlasMhdFile]}" "${Phantom[materialsDatFile]}" "${Script[rootDir]}/gate/materials/gate-materials.db")
   # 2. Tilt phantom density map to align in the transversal plane as if one would see it from the detector
   local phantomAtlasDensityMhdFile=$("${Script[toolsDir]}"/tilt-mhd "$phantomAtlasDensityMhdFile" -x)
   # make mhd haeader RTK compatible
-  local dimX=$(awk '$1~/^DimSize/{print $3}' "$phantomAtlasDensityMhdFile")
-  local dimY=$(awk '$1~/^DimSize/{print $4}' "$phantomAtlasDensityMhdFile")
-  local dimZ=$(awk '$1~/^DimSize/{print $5}' "$phantomAtlasDensityMhdFile")
-  sed -i "/^Offset/d; /^ElementSize/d; /^ElementSpacing/d; /^Modality/d" "$phantomAtlasDensityMhdFile"
-  sed -i "/^ElementDataFile.*/i Offset = -$(Bcf "$dimX/2") -$(Bcf "$dimY/2") -$(Bcf "$dimZ/2")\nElementSize = 1 1 1\nModality = MET_MOD_CT" "$phantomAtlasDensityMhdFile"
+  eval "$("${Script[toolsDir]}"/mhd-info "$phantomAtlasDensityMhdFile")"
+  local dimX=${DimSize[0]} dimY=${DimSize[1]} dimZ=${DimSize[2]}
+  "${Script[toolsDir]}"/mhd-edit "$phantomAtlasDensityMhdFile" ElementSpacing= \
+    "Offset=-$(Bcf "$dimX/2") -$(Bcf "$dimY/2") -$(Bcf "$dimZ/2")" "ElementSize=1 1 1" "Modality=MET_MOD_CT"
   # 3. Create an RTK geometry file
   local args=()
         args+=(--nproj="${CBCT[projections]}")
@@ -1893,11 +1922,10 @@ RtkCBCTforwardProjectionSimulation() #{{{
   EchoGnLog "rtkforwardprojections  ${args[*]}  >> rtkforwardprojections.log"
              rtkforwardprojections "${args[@]}" >> rtkforwardprojections.log
   # make mhd haeader RTK compatible
-  local dimX=$(awk '$1~/^DimSize/{print $3}' "${CBCT[projectionsMhdFile]}")
-  local dimY=$(awk '$1~/^DimSize/{print $4}' "${CBCT[projectionsMhdFile]}")
-  local dimZ=$(awk '$1~/^DimSize/{print $5}' "${CBCT[projectionsMhdFile]}")
-  sed -i "/^Offset/d; /^ElementSize/d; /^ElementSpacing/d; /^Modality/d" "${CBCT[projectionsMhdFile]}"
-  sed -i "/^ElementDataFile.*/i Offset = -$(Bcf "$dimX/2") -$(Bcf "$dimY/2") -$(Bcf "$dimZ/2")\nElementSize = 1 1 1\nModality = MET_MOD_CT" "${CBCT[projectionsMhdFile]}"
+  eval "$("${Script[toolsDir]}"/mhd-info "${CBCT[projectionsMhdFile]}")"
+  local dimX=${DimSize[0]} dimY=${DimSize[1]} dimZ=${DimSize[2]}
+  "${Script[toolsDir]}"/mhd-edit "${CBCT[projectionsMhdFile]}" ElementSpacing= \
+    "Offset=-$(Bcf "$dimX/2") -$(Bcf "$dimY/2") -$(Bcf "$dimZ/2")" "ElementSize=1 1 1" "Modality=MET_MOD_CT"
   EchoLog "$(Bcf "(($(date -d "$(date)" "+%s") - $(date -d "$time0" "+%s")) / 60)") min."
   } #}}}
 
@@ -1910,7 +1938,8 @@ MRISpinScenarioSimulation() #{{{
     spin-scenario "${Script[spinScenarioUserLuaFile]}"
   else
     #local -i phantomVoxelsZ=$(awk '$1~/^DimSize/{print $5}' "${Phantom[atlasMhdFile]}")
-    local -i phantomVoxelsZ=$(awk '$1~/^DimSize/{print $3}' "${Phantom[atlasMhdFile]}") # because of y-tilt !
+    eval "$("${Script[toolsDir]}"/mhd-info "${Phantom[atlasMhdFile]}")"
+    local -i phantomVoxelsZ=${DimSize[0]} # because of y-tilt !
     set +e # spin-scenario returns error for slices with no material TODO: this might be fixed already
     for (( sliceZ=0; sliceZ<phantomVoxelsZ; sliceZ++ )); do # run spin-scenario per slice
       local luaFile___="${Script[spinScenarioInterfaceFile]%.*}-$(printf "%03d\n" "$sliceZ").lua"
@@ -1935,33 +1964,8 @@ MRISpinScenarioSimulation() #{{{
       fi
       rm -rf "$luaFile___" "$output_dir___" # clean up
     done
-    gawk -i inplace -v var="$sliceZ" '$1~/^DimSize/{$5=var}1' raw-IMG-abs.mhd
-    gawk -i inplace -v var="$sliceZ" '$1~/^DimSize/{$5=var}1' raw-IMG-re.mhd
-    gawk -i inplace -v var="$sliceZ" '$1~/^DimSize/{$5=var}1' raw-IMG-im.mhd
-    gawk -i inplace -v var="$sliceZ" '$1~/^DimSize/{$5=var}1' raw-FID-abs.mhd
-    gawk -i inplace -v var="$sliceZ" '$1~/^DimSize/{$5=var}1' raw-FID-re.mhd
-    gawk -i inplace -v var="$sliceZ" '$1~/^DimSize/{$5=var}1' raw-FID-im.mhd
-    gawk -i inplace -v var="$sliceZ" '$1~/^DimSize/{$5=var}1' raw-SPEC-abs.mhd
-    gawk -i inplace -v var="$sliceZ" '$1~/^DimSize/{$5=var}1' raw-SPEC-re.mhd
-    gawk -i inplace -v var="$sliceZ" '$1~/^DimSize/{$5=var}1' raw-SPEC-im.mhd
-    "${Script[toolsDir]}"/tilt-mhd raw-IMG-abs.mhd  ++z
-    "${Script[toolsDir]}"/tilt-mhd raw-IMG-re.mhd   ++z
-    "${Script[toolsDir]}"/tilt-mhd raw-IMG-im.mhd   ++z
-    "${Script[toolsDir]}"/tilt-mhd raw-FID-abs.mhd  ++z
-    "${Script[toolsDir]}"/tilt-mhd raw-FID-re.mhd   ++z
-    "${Script[toolsDir]}"/tilt-mhd raw-FID-im.mhd   ++z
-    "${Script[toolsDir]}"/tilt-mhd raw-SPEC-abs.mhd ++z
-    "${Script[toolsDir]}"/tilt-mhd raw-SPEC-re.mhd  ++z
-    "${Script[toolsDir]}"/tilt-mhd raw-SPEC-im.mhd  ++z
-    "${Script[toolsDir]}"/mirror-mhd raw-IMG-abs+zz-tilted.mhd  -x
-    "${Script[toolsDir]}"/mirror-mhd raw-IMG-re+zz-tilted.mhd   -x
-    "${Script[toolsDir]}"/mirror-mhd raw-IMG-im+zz-tilted.mhd   -x
-    "${Script[toolsDir]}"/mirror-mhd raw-FID-abs+zz-tilted.mhd  -x
-    "${Script[toolsDir]}"/mirror-mhd raw-FID-re+zz-tilted.mhd   -x
-    "${Script[toolsDir]}"/mirror-mhd raw-FID-im+zz-tilted.mhd   -x
-    "${Script[toolsDir]}"/mirror-mhd raw-SPEC-abs+zz-tilted.mhd -x
-    "${Script[toolsDir]}"/mirror-mhd raw-SPEC-re+zz-tilted.mhd  -x
-    "${Script[toolsDir]}"/mirror-mhd raw-SPEC-im+zz-tilted.mhd  -x
+    "${Script[toolsDir]}"/mhd-edit raw-{IMG,FID,SPEC}-{abs,re,im}.mhd "DimSize[2]=$sliceZ"
+    "${Script[toolsDir]}"/orient-mhd ${Script[lazyOrientation]:+-l} raw-{IMG,FID,SPEC}-{abs,re,im}.mhd tilt ++z mirror -x # one pass, one process
   fi
   local endTime=$(date)
   local time=$(( $(date -d "$endTime" "+%s") - $(date -d "$startTime" "+%s") ))
@@ -2010,18 +2014,19 @@ EchoH33FromMhd_3Dfloat() #{{{
   {
   EchoBlLog "${FUNCNAME[0]}() ..."
   local mhdFile="$1"
+  eval "$("${Script[toolsDir]}"/mhd-info "$mhdFile")"
   echo "INTERFILE :="
   echo "version of keys := CASToRv1.0"
-  echo "name of data file := $(awk '$1~/^ElementDataFile/{print $3}' "$mhdFile")"
+  echo "name of data file := $ElementDataFile"
   echo "data offset in bytes := 0"
   echo "number format := float"
   echo "number of bytes per pixel := 4"
-  echo "matrix size [1] := $(awk '$1~/^DimSize/{print $3}' "$mhdFile")"
-  echo "matrix size [2] := $(awk '$1~/^DimSize/{print $4}' "$mhdFile")"
-  echo "matrix size [3] := $(awk '$1~/^DimSize/{print $5}' "$mhdFile")"
-  echo "scaling factor (mm/pixel) [1] := $(awk '$1~/^ElementSize/{print $3}' "$mhdFile")"
-  echo "scaling factor (mm/pixel) [2] := $(awk '$1~/^ElementSize/{print $4}' "$mhdFile")"
-  echo "scaling factor (mm/pixel) [3] := $(awk '$1~/^ElementSize/{print $5}' "$mhdFile")"
+  echo "matrix size [1] := ${DimSize[0]}"
+  echo "matrix size [2] := ${DimSize[1]}"
+  echo "matrix size [3] := ${DimSize[2]}"
+  echo "scaling factor (mm/pixel) [1] := ${ElementSize[0]}"
+  echo "scaling factor (mm/pixel) [2] := ${ElementSize[1]}"
+  echo "scaling factor (mm/pixel) [3] := ${ElementSize[2]}"
   echo "number of time frames := 1"
   } #}}}
 
@@ -2057,12 +2062,9 @@ CastorImageReconstruction() #{{{
   args+=(-proj "${Recon[intersectMethod]}")
   args+=(-it   "${Recon[iterations]}:${Recon[subsets]}")
   if [[ -v Phantom[atlasMhdFile] ]]; then
-    local fovDimX=$(awk '$1~/^DimSize/{print $3}' "${Phantom[atlasMhdFile]}")
-    local fovDimY=$(awk '$1~/^DimSize/{print $4}' "${Phantom[atlasMhdFile]}")
-    local fovDimZ=$(awk '$1~/^DimSize/{print $5}' "${Phantom[atlasMhdFile]}")
-    local fovPixdimX=$(awk '$1~/^ElementSize/{print $3}' "${Phantom[atlasMhdFile]}")
-    local fovPixdimY=$(awk '$1~/^ElementSize/{print $4}' "${Phantom[atlasMhdFile]}")
-    local fovPixdimZ=$(awk '$1~/^ElementSize/{print $5}' "${Phantom[atlasMhdFile]}")
+    eval "$("${Script[toolsDir]}"/mhd-info "${Phantom[atlasMhdFile]}")"
+    local fovDimX=${DimSize[0]} fovDimY=${DimSize[1]} fovDimZ=${DimSize[2]}
+    local fovPixdimX=${ElementSize[0]} fovPixdimY=${ElementSize[1]} fovPixdimZ=${ElementSize[2]}
     local fovX=$(Bcf "$fovDimX * $fovPixdimX")
     local fovY=$(Bcf "$fovDimY * $fovPixdimY")
     local fovZ=$(Bcf "$fovDimZ * $fovPixdimZ")
@@ -2099,19 +2101,34 @@ EchoMhdFromHdr_3Dfloat() #{{{
   echo "ElementDataFile = $rawFilename"
   } #}}}
 
+CreateMuMapFromPhantom() #{{{
+  {
+  # The attenuation map of the Gate MuMapActor is missing, e.g. for ReconstructionOnly of a run which was
+  # simulated without it: compute it natively from the phantom atlas and its materials at the isotope energy
+  local energyKeV
+  [[ "${Script[modality]}" =~ SPECT ]] && energyKeV=${SPECT[isotopeEnergyKeV]}
+  [[ "${Script[modality]}" =~ PET ]]   && energyKeV=${PET[isotopeEnergyKeV]}
+  EchoLog "Create attenuation map at $energyKeV keV from ${Phantom[atlasMhdFile]} ..."
+  "${Script[toolsDir]}"/create-mumap-mhd-from-phantom-mhd "${Phantom[atlasMhdFile]}" "${Phantom[materialsDatFile]}" \
+    "$energyKeV" "${Script[rootDir]}/gate/materials/gate-materials.db" > /dev/null
+  } #}}}
+
 SPECTCastorImageReconstruction() #{{{
   {
   EchoBlLog "${FUNCNAME[0]}() ..."
   local startTime=$(date)
+  [[ -v Phantom[atlasMhdFile] && -v Phantom[materialsDatFile] && ! -f "${Phantom[atlasMhdFile]%.*}-MuMap.mhd" ]] && CreateMuMapFromPhantom
   [[ -v Phantom[atlasMhdFile] ]] && EchoH33FromMhd_3Dfloat "${Phantom[atlasMhdFile]%.*}-MuMap.mhd" > "${Phantom[atlasMhdFile]%.*}-MuMap.h33"
   ConvertGateRootToCastorInput
   CastorImageReconstruction
   local hdrFiles="$(ls reco-output*.hdr)"
+  local mhdFiles=()
   for hdrFile in $hdrFiles; do
     EchoMhdFromHdr_3Dfloat "$hdrFile" > "${hdrFile%.*}.mhd"
-    "${Script[toolsDir]}"/tilt-mhd "${hdrFile%.*}.mhd" -z
+    mhdFiles+=("${hdrFile%.*}.mhd")
     rm "$hdrFile"
   done
+  (( ${#mhdFiles[@]} > 0 )) && "${Script[toolsDir]}"/tilt-mhd ${Script[lazyOrientation]:+-l} "${mhdFiles[@]}" -z # all frames in one process
   [[ -v Phantom[atlasMhdFile] ]] && rm "${Phantom[atlasMhdFile]%.*}-MuMap.h33"
   local endTime=$(date)
   local time=$(( $(date -d "$endTime" "+%s") - $(date -d "$startTime" "+%s") ))
@@ -2122,6 +2139,7 @@ PETCastorImageReconstruction() #{{{
   {
   EchoBlLog "${FUNCNAME[0]}() ..."
   local startTime=$(date)
+  [[ -v Phantom[atlasMhdFile] && -v Phantom[materialsDatFile] && ! -f "${Phantom[atlasMhdFile]%.*}-MuMap.mhd" ]] && CreateMuMapFromPhantom
   [[ -v Phantom[atlasMhdFile] ]] && EchoH33FromMhd_3Dfloat "${Phantom[atlasMhdFile]%.*}-MuMap.mhd" > "${Phantom[atlasMhdFile]%.*}-MuMap.h33"
   ConvertGateRootToCastorInput
   CastorImageReconstruction
@@ -2143,7 +2161,7 @@ CBCTRtkImageReconstruction() #{{{
   if [[ ! -v Script[CBCTforwardProjectionSimulation] ]]; then
     # 1. Tilt Gate projection output and make filename (no '+'), header (offset) compatible with RTK
     CBCT[projectionsMhdFile]=$("${Script[toolsDir]}"/tilt-mhd "${CBCT[projectionsMhdFile]}" +z)
-    sed -i '/^ElementDataFile/d' "${CBCT[projectionsMhdFile]}"
+    "${Script[toolsDir]}"/mhd-edit "${CBCT[projectionsMhdFile]}" ElementDataFile=
     # rtk cannot deal with '+' in file names TODO !!! must be ...
     mv gate-simulation-projections+z-tilted.mhd gate-simulation-projections-z-tilted.mhd
     mv gate-simulation-projections+z-tilted.raw gate-simulation-projections-z-tilted.raw
@@ -2202,12 +2220,16 @@ CBCTRtkImageReconstruction() #{{{
   EchoGnLog "$cmd  ${args[*]}  >> $cmd.log"
              $cmd "${args[@]}" >> $cmd.log
    # 4. Adjust header and scale and tilt reconstruction output to align with the phantom atlas
-  local sizeX=$(awk '$1~/^ElementSize/{print $3}' "${Phantom[atlasMhdFile]}")
+  eval "$("${Script[toolsDir]}"/mhd-info "${Phantom[atlasMhdFile]}")"
+  local sizeX=${ElementSize[0]}
   local voxelSize=$(Bcf "$sizeX * ${CBCT[sourceToCenterOfRotationDistanceZmm]} / ${CBCT[sourceToDetectorDistanceZmm]}")
-  sed -i "/^Offset/d; /^ElementSize/d; /^ElementSpacing/d; /^Modality/d" "$reconstructionMhdFile"
-  sed -i "/^ElementDataFile.*/i ElementSize = $voxelSize $voxelSize $voxelSize\nModality = MET_MOD_CT" "$reconstructionMhdFile"
-  reconstructionMhdFile=$("${Script[toolsDir]}"/tilt-mhd "$reconstructionMhdFile" +x)
-  [[ ! -v Script[CBCTforwardProjectionSimulation] ]] && reconstructionMhdFile=$("${Script[toolsDir]}"/tilt-mhd "$reconstructionMhdFile" +z)
+  "${Script[toolsDir]}"/mhd-edit "$reconstructionMhdFile" Offset= ElementSpacing= \
+    "ElementSize=$voxelSize $voxelSize $voxelSize" "Modality=MET_MOD_CT"
+  if [[ -v Script[CBCTforwardProjectionSimulation] ]]; then
+    reconstructionMhdFile=$("${Script[toolsDir]}"/tilt-mhd ${Script[lazyOrientation]:+-l} "$reconstructionMhdFile" +x)
+  else # tilt +x and +z in one pass
+    reconstructionMhdFile=$("${Script[toolsDir]}"/orient-mhd ${Script[lazyOrientation]:+-l} "$reconstructionMhdFile" tilt +x tilt +z)
+  fi
   local endTime=$(date)
   local time=$(( $(date -d "$endTime" "+%s") - $(date -d "$startTime" "+%s") ))
   EchoLog "Computational time: $(Bcf "($time / 60.)") min."
@@ -3,6 +3,100 @@
 
 using namespace std;
 
+// Places tumor voxels (offset by the max phantom atlas label) into a copy of the phantom atlas and writes it as TOUT
+template <typename TOUT, typename TP, typename TT> 
+void WriteAtlasWithTumor(const mhdHdr3D &phantomAtlasHdr, const rarray<const TP,3> &phantomAtlasImage, 
+                         const mhdHdr3D &tumorHdr, const rarray<const TT,3> &tumorImage, intxyz tumorCenterVoxel,
+                         uint64_t maxPhantomAtlas, const string &outputMhdFilename)
+  {
+  // Prepare outputImage and set it to phantomAtlasImage
+  rarray<TOUT,3> outputImage(phantomAtlasHdr.voxels.z, phantomAtlasHdr.voxels.y, phantomAtlasHdr.voxels.x);
+  for (int z = 0; z < phantomAtlasHdr.voxels.z; z++)
+    for (int y = 0; y < phantomAtlasHdr.voxels.y; y++)
+      for (int x = 0; x < phantomAtlasHdr.voxels.x; x++)
+        outputImage[z][y][x] = phantomAtlasImage[z][y][x];
+  // Place tumorImage into the outputImage
+  for (int z = 0; z < tumorHdr.voxels.z; z++)
+    for (int y = 0; y < tumorHdr.voxels.y; y++)
+      for (int x = 0; x < tumorHdr.voxels.x; x++)
+        if (tumorImage[z][y][x] > 0)
+          {
+          const int xx = tumorCenterVoxel.x - tumorHdr.voxels.x / 2 + x;
+          const int yy = tumorCenterVoxel.y - tumorHdr.voxels.y / 2 + y;
+          const int zz = tumorCenterVoxel.z - tumorHdr.voxels.z / 2 + z;
+          if (xx >= 0 && xx < phantomAtlasHdr.voxels.x &&
+              yy >= 0 && yy < phantomAtlasHdr.voxels.y &&
+              zz >= 0 && zz < phantomAtlasHdr.voxels.z)
+            outputImage[zz][yy][xx] = maxPhantomAtlas + tumorImage[z][y][x];
+          }
+  WriteMhd3DImage(outputMhdFilename, outputImage, phantomAtlasHdr.voxels, phantomAtlasHdr.voxelSize);
+  }
+
+// Works on phantom atlas (TP) and tumor (TT) data in their native element types; the output image is promoted
+// only as far as the largest tumor label requires. Returns the max label of the output image.
+template <typename TP, typename TT> 
+uint64_t AddTumor(const mhdHdr3D &phantomAtlasHdr, const mhdHdr3D &tumorHdr, intxyz tumorCenterVoxel,
+                  uint64_t &maxPhantomAtlas, const string &outputMhdFilename)
+  {
+  MhdImageView3D<TP> phantomAtlasView(phantomAtlasHdr);
+  const rarray<const TP,3> &phantomAtlasImage = phantomAtlasView.image();
+  MhdImageView3D<TT> tumorView(tumorHdr);
+  const rarray<const TT,3> &tumorImage = tumorView.image();
+  // Get max label in phantomAtlasImage
+  maxPhantomAtlas = 0;
+  for (int z = 0; z < phantomAtlasHdr.voxels.z; z++)
+    for (int y = 0; y < phantomAtlasHdr.voxels.y; y++)
+      for (int x = 0; x < phantomAtlasHdr.voxels.x; x++)
+        if (phantomAtlasImage[z][y][x] > maxPhantomAtlas)
+          maxPhantomAtlas = phantomAtlasImage[z][y][x];
+  // Get max tumor value that lands inside the phantom atlas (so we save with the right type)
+  uint64_t maxTumor = 0;
+  for (int z = 0; z < tumorHdr.voxels.z; z++)
+    for (int y = 0; y < tumorHdr.voxels.y; y++)
+      for (int x = 0; x < tumorHdr.voxels.x; x++)
+        if (tumorImage[z][y][x] > maxTumor)
+          {
+          const int xx = tumorCenterVoxel.x - tumorHdr.voxels.x / 2 + x;
+          const int yy = tumorCenterVoxel.y - tumorHdr.voxels.y / 2 + y;
+          const int zz = tumorCenterVoxel.z - tumorHdr.voxels.z / 2 + z;
+          if (xx >= 0 && xx < phantomAtlasHdr.voxels.x &&
+              yy >= 0 && yy < phantomAtlasHdr.voxels.y &&
+              zz >= 0 && zz < phantomAtlasHdr.voxels.z)
+            maxTumor = tumorImage[z][y][x];
+          }
+  const uint64_t maxOutput = maxPhantomAtlas + maxTumor;
+  if      (maxOutput < UINT8_MAX)
+    WriteAtlasWithTumor<uint8_t>(phantomAtlasHdr, phantomAtlasImage, tumorHdr, tumorImage, tumorCenterVoxel,
+                                 maxPhantomAtlas, outputMhdFilename);
+  else if (maxOutput < UINT16_MAX)
+    WriteAtlasWithTumor<uint16_t>(phantomAtlasHdr, phantomAtlasImage, tumorHdr, tumorImage, tumorCenterVoxel,
+                                  maxPhantomAtlas, outputMhdFilename);
+  else if (maxOutput < UINT32_MAX)
+    WriteAtlasWithTumor<uint32_t>(phantomAtlasHdr, phantomAtlasImage, tumorHdr, tumorImage, tumorCenterVoxel,
+                                  maxPhantomAtlas, outputMhdFilename);
+  else
+    WriteAtlasWithTumor<uint64_t>(phantomAtlasHdr, phantomAtlasImage, tumorHdr, tumorImage, tumorCenterVoxel,
+                                  maxPhantomAtlas, outputMhdFilename);
+  return maxOutput;
+  }
+
+template <typename TP> 
+uint64_t AddTumor(const mhdHdr3D &phantomAtlasHdr, const mhdHdr3D &tumorHdr, intxyz tumorCenterVoxel,
+                  uint64_t &maxPhantomAtlas, const string &outputMhdFilename)
+  {
+  switch (tumorHdr.elementType)
+    {
+    case MET_UCHAR:  
+      return AddTumor<TP,uint8_t>(phantomAtlasHdr, tumorHdr, tumorCenterVoxel, maxPhantomAtlas, outputMhdFilename);
+    case MET_USHORT: 
+      return AddTumor<TP,uint16_t>(phantomAtlasHdr, tumorHdr, tumorCenterVoxel, maxPhantomAtlas, outputMhdFilename);
+    case MET_ULONG:  
+      return AddTumor<TP,uint32_t>(phantomAtlasHdr, tumorHdr, tumorCenterVoxel, maxPhantomAtlas, outputMhdFilename);
+    default: ECHO_ERROR("tumorInsertMhdFilename must be MET_UCHAR, MET_USHORT or MET_ULONG");
+    }
+  return 0;
+  }
+
 int main(int argc, char *argv[])
   {
   // 1. Read in args
@@ -42,73 +136,30 @@ int main(int argc, char *argv[])
   if (!filesystem::exists(phantomAtlasMhdFilename))
     ECHO_ERROR("phantomAtlasMhdFilename %s does not exist", phantomAtlasMhdFilename.c_str());
   mhdHdr3D phantomAtlasHdr = ReadMhdHeader3D(phantomAtlasMhdFilename);
+  if (phantomAtlasHdr.transformMatrix != mhdHdr3D().transformMatrix)
+    ECHO_ERROR("'%s' has a TransformMatrix, materialize it first (orient-mhd -m)", phantomAtlasMhdFilename.c_str());
 //  string phantomAtlasDirectory = phantomAtlasMhdFilename.parent_path();
 //  phantomAtlasHdr.filenameRaw = phantomAtlasDirectory.append("/").append(phantomAtlasHdr.filenameRaw);
-  // Read phantomAtlas image data
-  rarray<uint64_t,3> phantomAtlasImage(phantomAtlasHdr.voxels.z, phantomAtlasHdr.voxels.y, 
-                                       phantomAtlasHdr.voxels.x);
-  if      (phantomAtlasHdr.elementType == MET_UCHAR)  READ_IMAGE(uint8_t,  phantomAtlasHdr, phantomAtlasImage)
-  else if (phantomAtlasHdr.elementType == MET_USHORT) READ_IMAGE(uint16_t, phantomAtlasHdr, phantomAtlasImage)
-  else if (phantomAtlasHdr.elementType == MET_ULONG)  READ_IMAGE(uint32_t, phantomAtlasHdr, phantomAtlasImage)
   // Read tumorInsertMhdFilename
   if (!filesystem::exists(tumorInsertMhdFilename))
     ECHO_ERROR("tumorInsertMhdFilename %s does not exist", tumorInsertMhdFilename.c_str());
   mhdHdr3D tumorHdr = ReadMhdHeader3D(tumorInsertMhdFilename);
+  if (tumorHdr.transformMatrix != mhdHdr3D().transformMatrix)
+    ECHO_ERROR("'%s' has a TransformMatrix, materialize it first (orient-mhd -m)", tumorInsertMhdFilename.c_str());
 //  string tumorDirectory = tumorInsertMhdFilename.parent_path();
 //  tumorHdr.filenameRaw = tumorDirectory.append("/").append(tumorHdr.filenameRaw);
-  rarray<uint64_t,3> tumorImage(tumorHdr.voxels.z, tumorHdr.voxels.y, tumorHdr.voxels.x);
-  if      (tumorHdr.elementType == MET_UCHAR)  READ_IMAGE(uint8_t,  tumorHdr, tumorImage)
-  else if (tumorHdr.elementType == MET_USHORT) READ_IMAGE(uint16_t, tumorHdr, tumorImage)
-  else if (tumorHdr.elementType == MET_ULONG)  READ_IMAGE(uint32_t, tumorHdr, tumorImage)
   // Check that voxelSize is the same in both mhd images
   if (phantomAtlasHdr.voxelSize.x != tumorHdr.voxelSize.x ||
       phantomAtlasHdr.voxelSize.y != tumorHdr.voxelSize.z ||
       phantomAtlasHdr.voxelSize.y != tumorHdr.voxelSize.z)
     ECHO_WARNING("phantomAtlasHdr.voxelSize != tumorHdr.voxelSize");
-  // Get max label in phantomAtlasImage
-  uint64_t maxPhantomAtlas = 0;
-  for (int z = 0; z < phantomAtlasHdr.voxels.z; z++)
-    for (int y = 0; y < phantomAtlasHdr.voxels.y; y++)
-      for (int x = 0; x < phantomAtlasHdr.voxels.x; x++)
-        if (phantomAtlasImage[z][y][x] > maxPhantomAtlas)
-          maxPhantomAtlas = phantomAtlasImage[z][y][x];
-  // Prepare outputImage and set it to phantomAtlasImage
-  rarray<uint64_t,3> outputImage(phantomAtlasHdr.voxels.z, phantomAtlasHdr.voxels.y, phantomAtlasHdr.voxels.x);
-  for (int z = 0; z < phantomAtlasHdr.voxels.z; z++)
-    for (int y = 0; y < phantomAtlasHdr.voxels.y; y++)
-      for (int x = 0; x < phantomAtlasHdr.voxels.x; x++)
-        outputImage[z][y][x] = phantomAtlasImage[z][y][x];
-  // Get center voxels of both input Images and place tumorImage into the outputImage
+  // Get center voxel of the tumor in the phantom atlas
   intxyz tumorCenterVoxel = 
     { 
     (int)(phantomAtlasHdr.voxels.x / 2 + round(tumorCenterOffset.x / phantomAtlasHdr.voxelSize.x)),
     (int)(phantomAtlasHdr.voxels.y / 2 + round(tumorCenterOffset.y / phantomAtlasHdr.voxelSize.y)),
     (int)(phantomAtlasHdr.voxels.z / 2 + round(tumorCenterOffset.z / phantomAtlasHdr.voxelSize.z))
     };
-  for (int z = 0; z < tumorHdr.voxels.z; z++)
-    for (int y = 0; y < tumorHdr.voxels.y; y++)
-      for (int x = 0; x < tumorHdr.voxels.x; x++)
-        if (tumorImage[z][y][x] > 0)
-          {
-          const int xx = tumorCenterVoxel.x - tumorHdr.voxels.x / 2 + x;
-          const int yy = tumorCenterVoxel.y - tumorHdr.voxels.y / 2 + y;
-          const int zz = tumorCenterVoxel.z - tumorHdr.voxels.z / 2 + z;
-          if (xx >= 0 && xx < phantomAtlasHdr.voxels.x &&
-              yy >= 0 && yy < phantomAtlasHdr.voxels.y &&
-              zz >= 0 && zz < phantomAtlasHdr.voxels.z)
-            outputImage[zz][yy][xx] = maxPhantomAtlas + tumorImage[z][y][x];
-          }
-  // Get max (label) value of outputImage (so we save with the right type)
-  uint64_t maxOutput = 0;
-  for (int z = 0; z < phantomAtlasHdr.voxels.z; z++)
-    for (int y = 0; y < phantomAtlasHdr.voxels.y; y++)
-      for (int x = 0; x < phantomAtlasHdr.voxels.x; x++)
-        if (outputImage[z][y][x] > maxOutput)
-          maxOutput = outputImage[z][y][x];
-//  // 7. Change into the tumorInsertMhdFilename directory and write to outputImage into it
-//  filesystem::current_path(tumorInsertMhdFilename.parent_path());
-  const uint64_t tumorLabelMin = maxPhantomAtlas + 1;
-  const uint64_t tumorLabelMax = maxOutput;
   filesystem::path outputMhdFilename = phantomAtlasMhdFilename.filename().stem().concat("-")
                                       .concat(tumorInsertMhdFilename.filename().stem().string()).concat("-at");
   if (tumorCenterVoxel.x >= 0) outputMhdFilename.concat("+").concat(to_string(tumorCenterVoxel.x));
@@ -117,18 +168,26 @@ int main(int argc, char *argv[])
   else                       outputMhdFilename.concat(to_string(tumorCenterVoxel.y));
   if (tumorCenterVoxel.z >= 0) outputMhdFilename.concat("+").concat(to_string(tumorCenterVoxel.z)).concat(".mhd");
   else                       outputMhdFilename.concat(to_string(tumorCenterVoxel.z)).concat(".mhd");
-  if      (maxOutput < UINT8_MAX)
-    WRITE_IMAGE(uint8_t, phantomAtlasHdr.voxels, phantomAtlasHdr.voxelSize, outputImage, 
-                outputMhdFilename.string())
-  else if (maxOutput < UINT16_MAX)
-    WRITE_IMAGE(uint16_t, phantomAtlasHdr.voxels, phantomAtlasHdr.voxelSize, outputImage, 
-                outputMhdFilename.string())
-  else if (maxOutput < UINT32_MAX)
-    WRITE_IMAGE(uint32_t, phantomAtlasHdr.voxels, phantomAtlasHdr.voxelSize, outputImage, 
-                outputMhdFilename.string())
-  else if (maxOutput < UINT64_MAX)
-    WRITE_IMAGE(uint64_t, phantomAtlasHdr.voxels, phantomAtlasHdr.voxelSize, outputImage, 
-                outputMhdFilename.string())
+  // Place tumorImage into the phantom atlas and write the outputImage
+  uint64_t maxPhantomAtlas = 0, maxOutput = 0;
+  switch (phantomAtlasHdr.elementType)
+    {
+    case MET_UCHAR:  
+      maxOutput = AddTumor<uint8_t>(phantomAtlasHdr, tumorHdr, tumorCenterVoxel, maxPhantomAtlas, 
+                                    outputMhdFilename.string()); 
+      break;
+    case MET_USHORT: 
+      maxOutput = AddTumor<uint16_t>(phantomAtlasHdr, tumorHdr, tumorCenterVoxel, maxPhantomAtlas, 
+                                     outputMhdFilename.string()); 
+      break;
+    case MET_ULONG:  
+      maxOutput = AddTumor<uint32_t>(phantomAtlasHdr, tumorHdr, tumorCenterVoxel, maxPhantomAtlas, 
+                                     outputMhdFilename.string()); 
+      break;
+    default: ECHO_ERROR("phantomAtlasMhdFilename must be MET_UCHAR, MET_USHORT or MET_ULONG");
+    }
+  const uint64_t tumorLabelMin = maxPhantomAtlas + 1;
+  const uint64_t tumorLabelMax = maxOutput;
   // the following string is used in musire.sh
   cout << outputMhdFilename.string() << " " << tumorLabelMin << " " << tumorLabelMax << endl;
   return 0;
@@ -0,0 +1,36 @@
+#include "misc.h"
+
+using namespace std;
+
+template <typename T> void CopyImage(const mhdHdr3D &inHdr, const mhdHdr3D &outHdr)
+  {
+  MhdSlabReader3D<T> reader(inHdr, GetSlabHeight<T>(inHdr));
+  MhdSlabWriter3D<T> writer(outHdr);
+  while (reader.next())
+    writer.write(reader.slab());
+  writer.close();
+  }
+
+int main(int argc, char *argv[])
+  {
+  if (argc != 2 && !(argc == 3 && strcmp("-d", argv[2]) == 0))
+    ECHO_ERROR("$ compress-mhd <in.mhd> [-d]\n"
+               "  Writes <in>-compressed.mhd/.zraw (CompressedData = True, readable by ITK/Aliza), or with -d\n"
+               "  <in>-uncompressed.mhd/.raw. The image is streamed in z-slabs, so memory does not depend on its size.");
+  const string inMhdFilename = argv[1];
+  if (!filesystem::exists(inMhdFilename))
+    ECHO_ERROR("'%s' does not exist", inMhdFilename.c_str());
+  const bool compress = (argc == 2);
+  const string str = compress ? "-compressed" : "-uncompressed";
+
+  mhdHdr3D inHdr  = ReadMhdHeader3D(inMhdFilename);
+  mhdHdr3D outHdr = inHdr;
+  outHdr.filenameMhd    = inMhdFilename.substr(0, inMhdFilename.find_last_of('.')) + str + ".mhd";
+  outHdr.filenameRaw    = inHdr.filenameRaw.substr(0, inHdr.filenameRaw.find_last_of('.')) + str +
+                          (compress ? ".zraw" : ".raw");
+  outHdr.compressedData = compress;
+  VisitElementType(inHdr.elementType, [&](auto tag) { CopyImage<typename decltype(tag)::type>(inHdr, outHdr); });
+  // the following string can be used in musire.sh
+  cout << outHdr.filenameMhd << endl;
+  return 0;
+  }
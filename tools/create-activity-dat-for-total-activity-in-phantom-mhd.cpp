@@ -4,7 +4,7 @@ using namespace std;
 
 int main(int argc, char *argv[])
   {
-  if (argc != 5)
+  if (argc < 5)
     {
     cout << "  re-calculates the activity values in a Gate-compatible activity range file to solve for the\n";
     cout << "  requested total activity (in MBq) in the accompanying phantom atlas.\n";
@@ -12,29 +12,46 @@ int main(int argc, char *argv[])
     cout << "                                                                     <inputPhantomActivityRange.dat>\n";
     cout << "                                                                     <totalActivityMBq>\n";
     cout << "                                                                     <outputPhantomActivityRange.dat>\n";
+    cout << "                                                                     [<labelStart>:<labelEnd>=<MBq> ...]\n";
+    cout << "  All activities are scaled by one factor, so their ratios (e.g. tumor to background) are kept. A region\n";
+    cout << "  <labelStart>:<labelEnd>=<MBq> gets a fixed total activity instead (its own ratios are kept) and the\n";
+    cout << "  other labels share the rest of the total activity.\n";
     exit(0);
     }
   const string inputPhantomAtlasMhdFilename          = argv[1];
   const string inputPhantomActivityRangeDatFilename  = argv[2];
-  const float  outputActivityMBqRequired             = atof(argv[3]);
+  const double outputActivityMBqRequired             = atof(argv[3]);
   const string outputPhantomActivityRangeDatFilename = argv[4];
-  // 1. Read mhd phantom image
+  struct activityRegion { int labelStart, labelEnd; double activityMBq; };
+  vector<activityRegion> fixedRegions;
+  for (int i = 5; i < argc; i++)
+    {
+    activityRegion region;
+    char c;
+    if (sscanf(argv[i], "%d:%d=%lf%c", &region.labelStart, &region.labelEnd, &region.activityMBq, &c) != 3 ||
+        region.labelStart > region.labelEnd || region.activityMBq < 0.0)
+      ECHO_ERROR("Invalid fixed region '%s' (expected <labelStart>:<labelEnd>=<MBq>)", argv[i]);
+    for (const activityRegion &other : fixedRegions)
+      if (region.labelStart <= other.labelEnd && other.labelStart <= region.labelEnd)
+        ECHO_ERROR("Fixed region '%s' overlaps another fixed region", argv[i]);
+    fixedRegions.push_back(region);
+    }
+  // 1. Read mhd phantom image header
   mhdHdr3D hdr = ReadMhdHeader3D(inputPhantomAtlasMhdFilename);
+  if (hdr.transformMatrix != mhdHdr3D().transformMatrix)
+    ECHO_ERROR("'%s' has a TransformMatrix, materialize it first (orient-mhd -m)", inputPhantomAtlasMhdFilename.c_str());
   if (hdr.elementType != MET_UCHAR && hdr.elementType != MET_USHORT)
     ECHO_ERROR("Voxelized phantom must be (for the time being) MET_UCHAR or MET_USHORT"); // TODO: include more when needed
-  rarray<uint16_t,3> phantomImage(hdr.voxels.z, hdr.voxels.y, hdr.voxels.x);
-  ReadMhdImage3D(hdr, &phantomImage);
   // 2. Read phantom activity range (.dat) and calculate total activity
   ifstream      inputFile(inputPhantomActivityRangeDatFilename);
   string        line;
   int           labelStart, labelEnd;
-  float         activity;
-  vector<int>   labels;
-  vector<float> activities;
+  double         activity;
+  vector<int>    labels;
+  vector<double> activities;
   while (getline(inputFile, line)) // Read one line at a time into line
     {
     stringstream lineStream(line);
-    cout << lineStream.str() << endl;
     if (line.length() < 3 || (line[0] == '#')) continue; // line is too short or starts with '#'
     lineStream >> labelStart;
     lineStream >> labelEnd;
@@ -48,43 +65,71 @@ int main(int argc, char *argv[])
       }
     }
   inputFile.close();
-  // 3. Calculate phantom atlas histogram
+  // 3. Calculate phantom atlas histogram (streamed); the voxels of a label count for its first listing only
   vector<long int> phantomHistogram(labels.size());
-  for (int z = 0; z < hdr.voxels.z; z++)
-    for (int y = 0; y < hdr.voxels.y; y++)
-      for (int x = 0; x < hdr.voxels.x; x++)
-        for (size_t l = 0; l < labels.size(); l++)
-          if (phantomImage[z][y][x] == labels[l])
-            { phantomHistogram[l]++; break; }
-  // 4. Get total activity of input phantom activity range
-  double   inputActivityBq = 0.0;
-  long int activityVoxels  = 0;
-  for (size_t l = 0; l < labels.size(); l++)
+  auto GetPhantomHistogram = [&](const auto &histogram)
     {
-    inputActivityBq += activities[l] * phantomHistogram[l];
-    activityVoxels  += phantomHistogram[l];
-    }
-  const double inputActivityMBq = inputActivityBq * 0.000001;
+    vector<bool> counted(histogram.size(), false);
+    for (size_t l = 0; l < labels.size(); l++)
+      if (labels[l] < (int)histogram.size() && !counted[labels[l]])
+        {
+        phantomHistogram[l] = histogram[labels[l]];
+        counted[labels[l]]  = true;
+        }
+    };
+  if (hdr.elementType == MET_UCHAR) GetPhantomHistogram(GetLabelHistogram3D<uint8_t>(hdr));
+  else                              GetPhantomHistogram(GetLabelHistogram3D<uint16_t>(hdr));
+  // 4. Get input activity of each region: 0 is the rest of the labels, r + 1 the fixed region r
+  vector<int> region(labels.size(), 0);
+  for (size_t l = 0; l < labels.size(); l++)
+    for (size_t r = 0; r < fixedRegions.size(); r++)
+      if (labels[l] >= fixedRegions[r].labelStart && labels[l] <= fixedRegions[r].labelEnd)
+        region[l] = r + 1;
+  vector<double> inputRegionActivityMBq(fixedRegions.size() + 1, 0.0);
+  for (size_t l = 0; l < labels.size(); l++)
+    inputRegionActivityMBq[region[l]] += activities[l] * phantomHistogram[l] * 0.000001;
+  const double inputActivityMBq = accumulate(inputRegionActivityMBq.begin(), inputRegionActivityMBq.end(), 0.0);
   const double inputActivitymCi = inputActivityMBq * 0.027027027;
   cout << "Total input activity  = " << inputActivityMBq << " MBq (= " << inputActivitymCi << " mCi)\n";
-  // 5. Calclate phantom activity range values which yields required total activity
-  if (hypot(inputActivityMBq, outputActivityMBqRequired) <= 0.001)
-    ECHO_ERROR("hypot(inputActivityMBq, outputActivityMBqRequired) is less than 0.001.");
-  double outputActivityMBq, outputActivityMBqCalculated;
-  double activityScaling = outputActivityMBqRequired / inputActivityMBq;
-  while (true)
+  // 5. Solve for the scaling of each region: the activity of a region is linear in its scaling, so each fixed region 
+  //    is scaled to its activity and the rest of the labels to the remaining activity
+  vector<double> requiredRegionActivityMBq(fixedRegions.size() + 1);
+  requiredRegionActivityMBq[0] = outputActivityMBqRequired;
+  for (size_t r = 0; r < fixedRegions.size(); r++)
     {
-    outputActivityMBq = activityScaling * inputActivityMBq / activityVoxels;
-    outputActivityMBqCalculated = 0.0;
-    for (size_t l = 0; l < labels.size(); l++)
-      outputActivityMBqCalculated += activities[l] * outputActivityMBq * phantomHistogram[l];
-    if (fabs(outputActivityMBqRequired - outputActivityMBqCalculated) < 0.001)
-      break;
-    activityScaling = (outputActivityMBqCalculated > outputActivityMBqRequired) ? activityScaling - 1.0 / activityVoxels :
-                                                                                  activityScaling + 1.0 / activityVoxels;
+    requiredRegionActivityMBq[r + 1]  = fixedRegions[r].activityMBq;
+    requiredRegionActivityMBq[0]     -= fixedRegions[r].activityMBq;
+    }
+  const double tolerance = 1e-9 * max(1.0, outputActivityMBqRequired); // MBq
+  if (requiredRegionActivityMBq[0] < -tolerance)
+    ECHO_ERROR("The fixed regions have more than the total activity of %g MBq", outputActivityMBqRequired);
+  vector<double> regionScaling(fixedRegions.size() + 1, 0.0);
+  for (size_t r = 0; r < regionScaling.size(); r++)
+    {
+    if (fabs(requiredRegionActivityMBq[r]) <= tolerance) continue;
+    if (inputRegionActivityMBq[r] <= 0.0)
+      {
+      if (r == 0) ECHO_ERROR("The labels outside of the fixed regions have no activity in the phantom atlas");
+      ECHO_ERROR("The fixed region %d:%d has no activity in the phantom atlas", 
+                 fixedRegions[r - 1].labelStart, fixedRegions[r - 1].labelEnd);
+      }
+    regionScaling[r] = requiredRegionActivityMBq[r] / inputRegionActivityMBq[r];
     }
   for (size_t l = 0; l < labels.size(); l++)
-    activities[l] = activities[l] * outputActivityMBq / 0.000001; // in Bq
+    activities[l] *= regionScaling[region[l]]; // in Bq
+  // validate the solution against the atlas histogram
+  vector<double> outputRegionActivityMBq(fixedRegions.size() + 1, 0.0);
+  for (size_t l = 0; l < labels.size(); l++)
+    outputRegionActivityMBq[region[l]] += activities[l] * phantomHistogram[l] * 0.000001;
+  for (size_t r = 0; r < regionScaling.size(); r++)
+    if (fabs(outputRegionActivityMBq[r] - max(0.0, requiredRegionActivityMBq[r])) > tolerance)
+      ECHO_ERROR("Scaled activity %g MBq of region %zu does not match the required %g MBq", 
+                 outputRegionActivityMBq[r], r, requiredRegionActivityMBq[r]);
+  for (size_t r = 0; r < fixedRegions.size(); r++)
+    cout << "Fixed region " << fixedRegions[r].labelStart << ":" << fixedRegions[r].labelEnd << " = " 
+         << outputRegionActivityMBq[r + 1] << " MBq\n";
+  const double outputActivityMBqCalculated = accumulate(outputRegionActivityMBq.begin(), outputRegionActivityMBq.end(),
+                                                        0.0);
   const double outputActivitymCiCalculated = outputActivityMBqCalculated  * 0.027027027;
   cout << "Total output activity = " << outputActivityMBqCalculated << " MBq (= " << outputActivitymCiCalculated << " mCi)\n";
   // 6. Write output activity range file
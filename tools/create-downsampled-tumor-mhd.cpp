@@ -2,6 +2,142 @@
 
 using namespace std;
 
+// Output voxel o covers the input cells [o * ratio, (o + 1) * ratio) along an axis (ratio = output voxel size / cell 
+// size >= 1); an input cell straddling two output voxels is shared by them by its overlap. Integer ratios have
+// weights of 1 only and give exact counts; the fractional counts of non-integer ratios are rounded to whole cells so
+// that the total number of cells is kept (see RoundCellCounts).
+struct blockAxis
+  {
+  double ratio;
+  int    inVoxels, outVoxels;
+  // overlap of input cell i with output voxel o
+  double weight(int i, int o) const 
+    { return std::max(0.0, std::min(i + 1.0, (o + 1) * ratio) - std::max<double>(i, o * ratio)); }
+  bool integer() const { return ratio == round(ratio); }
+  // input cells [first, last) overlapping output voxel o
+  int first(int o) const { return std::min(inVoxels, (int)floor(o * ratio)); }
+  int last(int o)  const { return std::min(inVoxels, (int)ceil((o + 1) * ratio)); }
+  };
+
+blockAxis GetBlockAxis(int inVoxels, double ratio)
+  {
+  blockAxis a;
+  a.ratio     = (fabs(ratio - round(ratio)) < 1e-5 * ratio) ? round(ratio) : ratio; // tolerates rounding errors
+  a.inVoxels  = inVoxels;
+  a.outVoxels = (int)ceil(inVoxels / a.ratio);
+  return a;
+  }
+
+// rounds the fractional cell counts to whole cells by the largest remainder method: each count is rounded down and
+// the cells then still missing for the rounded total go to the voxels with the largest remainders (the lower index 
+// first on ties), so the output holds as many cells as the input and no voxel is off by one cell or more
+void RoundCellCounts(const rarray<double,3> &counts, rarray<uint64_t,3> &outputImage)
+  {
+  const ra::size_type n = counts.size();
+  const double *count = counts.data();
+  uint64_t *out = outputImage.data();
+  long double total = 0.0;
+  uint64_t    floorTotal = 0;
+  for (ra::size_type i = 0; i < n; i++)
+    {
+    out[i] = (uint64_t)floor(count[i] + 1e-9); // a count summed to 2.9999999999 is 3 cells
+    total      += count[i];
+    floorTotal += out[i];
+    }
+  const uint64_t roundedTotal = (uint64_t)llroundl(total);
+  if (roundedTotal <= floorTotal) return;
+  std::vector<ra::size_type> order;
+  for (ra::size_type i = 0; i < n; i++)
+    if (count[i] > (double)out[i]) order.push_back(i);
+  const size_t missing = std::min<size_t>(roundedTotal - floorTotal, order.size());
+  auto larger = [&](ra::size_type a, ra::size_type b)
+    {
+    const double remainderA = count[a] - out[a], remainderB = count[b] - out[b];
+    return remainderA > remainderB || (remainderA == remainderB && a < b);
+    };
+  std::nth_element(order.begin(), order.begin() + missing, order.end(), larger);
+  for (size_t k = 0; k < missing; k++) out[order[k]]++;
+  }
+
+// counts the non-zero input voxels per output voxel and returns the maximum count. The input is streamed once in 
+// z-slabs (memory does not depend on the input image size); per slab the output rows it touches are filled in 
+// parallel, each by summing the input rows of its block column-wise (branch-free, vectorizable) and then the columns
+// of each output voxel, the last partial block included. Only a column on a non-integer block border is weighted and 
+// shared with the next voxel.
+template <typename T> uint64_t CountCells(const mhdHdr3D &hdr, const blockAxis ax[3], rarray<uint64_t,3> &outputImage)
+  {
+  const blockAxis &bx = ax[0], &by = ax[1], &bz = ax[2];
+  // weighted counts are needed for non-integer ratios only; integer ratios are counted in the output image itself
+  const bool fractional = !(bx.integer() && by.integer() && bz.integer());
+  rarray<double,3> counts(fractional ? bz.outVoxels : 0, by.outVoxels, bx.outVoxels);
+  std::fill(counts.data(), counts.data() + counts.size(), 0.0);
+  std::fill(outputImage.data(), outputImage.data() + outputImage.size(), 0);
+  // per output x: the columns [fullBegin, fullEnd) inside it, and the share of column fullEnd (the border column; the
+  // rest goes to the next voxel)
+  std::vector<int>    fullBegin(bx.outVoxels), fullEnd(bx.outVoxels);
+  std::vector<double> borderWeight(bx.outVoxels, 0.0);
+  for (int ox = 0; ox < bx.outVoxels; ox++)
+    {
+    fullBegin[ox] = std::min(bx.inVoxels, (int)ceil(ox * bx.ratio));
+    fullEnd[ox]   = std::min(bx.inVoxels, (int)floor((ox + 1) * bx.ratio));
+    if (fullEnd[ox] < bx.inVoxels) borderWeight[ox] = bx.weight(fullEnd[ox], ox);
+    }
+  MhdSlabReader3D<T> inputReader(hdr, GetSlabHeight<T>(hdr));
+  while (inputReader.next())
+    {
+    const rarray<T,3> &inputSlab = inputReader.slab();
+    const int z0 = inputReader.z0(), z1 = z0 + inputReader.slices();
+    const int oz0 = std::min(bz.outVoxels - 1, (int)floor(z0 / bz.ratio)),
+              oz1 = std::min(bz.outVoxels, (int)ceil(z1 / bz.ratio));
+    ParallelFor(0, (size_t)(oz1 - oz0) * by.outVoxels, [&](size_t t)
+      {
+      // 1. Sum the rows of the block per column: rows lying completely in the block exactly, others by their weight
+      thread_local std::vector<uint32_t> columnSums;
+      thread_local std::vector<double>   columnWeights;
+      columnSums.assign(bx.inVoxels, 0);
+      if (fractional) columnWeights.assign(bx.inVoxels, 0.0);
+      const int oz = oz0 + (int)(t / by.outVoxels), oy = (int)(t % by.outVoxels);
+      for (int iz = std::max(z0, bz.first(oz)); iz < std::min(z1, bz.last(oz)); iz++)
+        for (int iy = by.first(oy); iy < by.last(oy); iy++)
+          {
+          const double w = bz.weight(iz, oz) * by.weight(iy, oy);
+          const T *row = &inputSlab[iz - z0][iy][0];
+          if (w == 1.0)
+            for (int ix = 0; ix < bx.inVoxels; ix++)
+              columnSums[ix] += (row[ix] != 0);
+          else
+            for (int ix = 0; ix < bx.inVoxels; ix++)
+              columnWeights[ix] += w * (row[ix] != 0);
+          }
+      // 2. Sum the columns of each output voxel
+      if (!fractional)
+        {
+        uint64_t *out = &outputImage[oz][oy][0];
+        for (int ox = 0; ox < bx.outVoxels; ox++)
+          {
+          uint64_t sum = 0;
+          for (int ix = fullBegin[ox]; ix < fullEnd[ox]; ix++)
+            sum += columnSums[ix];
+          out[ox] += sum;
+          }
+        return;
+        }
+      double *dst = &counts[oz][oy][0], carry = 0.0; // carry: share of the border column of the previous voxel
+      for (int ox = 0; ox < bx.outVoxels; ox++)
+        {
+        double sum = 0.0;
+        for (int ix = fullBegin[ox]; ix < fullEnd[ox]; ix++)
+          sum += columnSums[ix] + columnWeights[ix];
+        const double border = (borderWeight[ox] > 0.0) ? columnSums[fullEnd[ox]] + columnWeights[fullEnd[ox]] : 0.0;
+        dst[ox] += sum + carry + border * borderWeight[ox];
+        carry = border * (1.0 - borderWeight[ox]);
+        }
+      });
+    }
+  if (fractional) RoundCellCounts(counts, outputImage);
+  return *std::max_element(outputImage.data(), outputImage.data() + outputImage.size());
+  }
+
 int main(int argc, char *argv[])
   {
   if (argc != 6)
@@ -10,7 +146,9 @@ int main(int argc, char *argv[])
             "USAGE: create-downsampled-tumor-mhd <inputTumorGrowthSimulationMhdFilename.mhd>\n"
             "                                    <inputCellSize>\n"
             "                                    <outputVoxelSizeX> <outputVoxelSizeY> <outputVoxelSizeZ>\n"
-            "whereby <outputVoxelSize> (%f [mm]) must be a multiple of ElementSize in the input mhd image. "
+            "whereby <outputVoxelSize> [mm] must not be smaller than <inputCellSize>; if it is not a multiple of it, "
+            "cells on block borders are shared by the overlapping output voxels (rounded to whole cells, keeping "
+            "the total). "
             "The input image voxel values might be binary (cell/no cell) or might have LESION or GENOTYPE information."
             "ElementType of the input image might be MET_UCHAR, MET_USHORT, MET_ULONG, or MET_ULONG_LONG."
             "The downsampled output mhd image voxels are being assigned with the accumulated numbers of corresponding"
@@ -29,57 +167,29 @@ int main(int argc, char *argv[])
   if (hdr.elementType != MET_UCHAR && hdr.elementType != MET_USHORT && 
       hdr.elementType != MET_ULONG && hdr.elementType != MET_ULONG_LONG)
     ECHO_ERROR("Input image elementType must be MET_UCHAR, MET_USHORT, MET_ULONG, or MET_ULONG_LONG");
-  if (fmod(outputVoxelSize.x * 100000, inputCellSize * 100000) != 0.0) //  * 100000 wg. rounding error
-    ECHO_ERROR("<outputVoxelSize.x> (%f [mm]) must be a multiple of ElementSize %f in the input mhd image",
-                outputVoxelSize.x, inputCellSize);
-  if (fmod(outputVoxelSize.y * 100000, inputCellSize * 100000) != 0.0) //  * 100000 wg. rounding error
-    ECHO_ERROR("<outputVoxelSize.y> (%f [mm]) must be a multiple of ElementSize %f in the input mhd image",
-                outputVoxelSize.y, inputCellSize);
-  if (fmod(outputVoxelSize.z * 100000, inputCellSize * 100000) != 0.0) //  * 100000 wg. rounding error
-    ECHO_ERROR("<outputVoxelSize.z> (%f [mm]) must be a multiple of ElementSize %f in the input mhd image",
-                outputVoxelSize.z, inputCellSize);
-  // 5. Read input image data
-  rarray<uint64_t,3> inputImage(hdr.voxels.z, hdr.voxels.y, hdr.voxels.x);
-  if      (hdr.elementType == MET_UCHAR)      READ_IMAGE(uint8_t,  hdr, inputImage)
-  else if (hdr.elementType == MET_USHORT)     READ_IMAGE(uint16_t, hdr, inputImage)
-  else if (hdr.elementType == MET_ULONG)      READ_IMAGE(uint32_t, hdr, inputImage)
-  else if (hdr.elementType == MET_ULONG_LONG) READ_IMAGE(uint64_t, hdr, inputImage)
-  // 6. Prepare output image
-  const uint16_t inputVoxelsPerOutputVoxelX = (uint16_t)(outputVoxelSize.x / inputCellSize);
-  const uint16_t inputVoxelsPerOutputVoxelY = (uint16_t)(outputVoxelSize.y / inputCellSize);
-  const uint16_t inputVoxelsPerOutputVoxelZ = (uint16_t)(outputVoxelSize.z / inputCellSize);
-  const intxyz outputVoxels = { (int)(ceil)(hdr.voxels.x / (outputVoxelSize.x / inputCellSize)),
-                                (int)(ceil)(hdr.voxels.y / (outputVoxelSize.y / inputCellSize)),
-                                (int)(ceil)(hdr.voxels.z / (outputVoxelSize.z / inputCellSize)) };
+  if (outputVoxelSize.x < inputCellSize || outputVoxelSize.y < inputCellSize || outputVoxelSize.z < inputCellSize)
+    ECHO_ERROR("<outputVoxelSize> (%f %f %f [mm]) must not be smaller than the cell size %f",
+                outputVoxelSize.x, outputVoxelSize.y, outputVoxelSize.z, inputCellSize);
+  // 5. Prepare output image
+  const blockAxis blockAxes[3] = { GetBlockAxis(hdr.voxels.x, outputVoxelSize.x / inputCellSize),
+                                   GetBlockAxis(hdr.voxels.y, outputVoxelSize.y / inputCellSize),
+                                   GetBlockAxis(hdr.voxels.z, outputVoxelSize.z / inputCellSize) };
+  const intxyz outputVoxels = { blockAxes[0].outVoxels, blockAxes[1].outVoxels, blockAxes[2].outVoxels };
   rarray<uint64_t,3> outputImage(outputVoxels.z, outputVoxels.y, outputVoxels.x);
-  outputImage.fill(0);
-  // 7. Calc output image
+  // 6. Calc output image (input data are read in their native element type)
   uint64_t max = 0;
-  for (int oz = 0; oz < outputVoxels.z; oz++)
-    for (int oy = 0; oy < outputVoxels.y; oy++)
-      for (int ox = 0; ox < outputVoxels.x; ox++)
-        {
-        uint64_t sum = 0;
-        const int ix0 = ox * inputVoxelsPerOutputVoxelX,
-                  iy0 = oy * inputVoxelsPerOutputVoxelY,
-                  iz0 = oz * inputVoxelsPerOutputVoxelZ;
-        for (int iz = 0; iz < inputVoxelsPerOutputVoxelZ; iz++)
-          for (int iy = 0; iy < inputVoxelsPerOutputVoxelY; iy++)
-            for (int ix = 0; ix < inputVoxelsPerOutputVoxelX; ix++)
-              if (ix0 + ix < hdr.voxels.x && iy0 + iy < hdr.voxels.y && iz0 + iz < hdr.voxels.z)
-                if (inputImage[iz0 + iz][iy0 + iy][ix0 + ix] > 0)
-                  ++sum;
-        outputImage[oz][oy][ox] = sum;
-        if (sum > max)
-          max = sum;
-        }
-  // 8. Write output image
+  switch (hdr.elementType)
+    {
+    case MET_UCHAR:      max = CountCells<uint8_t>(hdr, blockAxes, outputImage); break;
+    case MET_USHORT:     max = CountCells<uint16_t>(hdr, blockAxes, outputImage); break;
+    case MET_ULONG:      max = CountCells<uint32_t>(hdr, blockAxes, outputImage); break;
+    case MET_ULONG_LONG: max = CountCells<uint64_t>(hdr, blockAxes, outputImage); break;
+    default: break;
+    }
+  // 7. Write output image
   const string outputMhdFilename = inputMhdFilename.substr(0, inputMhdFilename.find_last_of(".")) + "-downsampled-" + argv[2] + ".mhd";
   hdr.filenameRaw = outputMhdFilename.substr(0, inputMhdFilename.find_last_of(".")) + ".raw";
-  if      (max < UINT8_MAX)  WRITE_IMAGE(uint8_t,  outputVoxels, outputVoxelSize, outputImage, outputMhdFilename)
-  else if (max < UINT16_MAX) WRITE_IMAGE(uint16_t, outputVoxels, outputVoxelSize, outputImage, outputMhdFilename)
-  else if (max < UINT32_MAX) WRITE_IMAGE(uint32_t, outputVoxels, outputVoxelSize, outputImage, outputMhdFilename)
-  else if (max < UINT64_MAX) WRITE_IMAGE(uint64_t, outputVoxels, outputVoxelSize, outputImage, outputMhdFilename)
+  WriteMhd3DImageFittingMax(outputMhdFilename, outputImage, outputVoxels, outputVoxelSize, max);
   cout << outputMhdFilename << endl;
   return 0;
   }
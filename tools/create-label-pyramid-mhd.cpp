@@ -0,0 +1,49 @@
+#include "misc.h"
+
+using namespace std;
+
+// true if the level image exists and was written after the input (header and data)
+static bool IsUpToDate(const mhdHdr3D &inHdr, const string &levelMhdFilename)
+  {
+  if (!filesystem::exists(levelMhdFilename)) return false;
+  const mhdHdr3D levelHdr = ReadMhdHeader3D(levelMhdFilename);
+  if (!filesystem::exists(levelHdr.filenameRaw)) return false;
+  const auto levelTime = min(filesystem::last_write_time(levelMhdFilename), 
+                             filesystem::last_write_time(levelHdr.filenameRaw));
+  for (const string &filenameRaw : GetMhdRawFilenames(inHdr))
+    if (filesystem::last_write_time(filenameRaw) > levelTime) return false;
+  return filesystem::last_write_time(inHdr.filenameMhd) <= levelTime;
+  }
+
+int main(int argc, char *argv[])
+  {
+  if (argc != 3 || atoi(argv[2]) < 1)
+    ECHO_ERROR("$ create-label-pyramid-mhd <in.mhd> <levels>\n"
+               "  Builds levels 1 ... <levels> of a label atlas pyramid next to it: level l is the atlas downsampled\n"
+               "  by 2^l with a majority vote (mode) per block, <in>-pyramid<2^l>x.mhd. Levels that are newer than\n"
+               "  the atlas are reused. Prints the file names of all levels, level 1 first.");
+  const string inMhdFilename = argv[1];
+  if (!filesystem::exists(inMhdFilename))
+    ECHO_ERROR("'%s' does not exist", inMhdFilename.c_str());
+  const mhdHdr3D inHdr  = ReadMhdHeader3D(inMhdFilename);
+  const int      levels = atoi(argv[2]);
+  if (inHdr.transformMatrix != mhdHdr3D().transformMatrix)
+    ECHO_ERROR("'%s' has a TransformMatrix, materialize it first (orient-mhd -m)", inMhdFilename.c_str());
+
+  // each level from the atlas itself (a mode of modes is not the mode of the block)
+  for (int level = 1; level <= levels; level++)
+    {
+    const int factor = 1 << level;
+    mhdHdr3D outHdr = GetDerivedMhdHdr3D(inHdr, "-pyramid" + to_string(factor) + "x");
+    if (!IsUpToDate(inHdr, outHdr.filenameMhd))
+      VisitElementType(inHdr.elementType, [&](auto tag)
+        {
+        typedef typename decltype(tag)::type T;
+        if constexpr (is_integral<T>::value) WriteModeDownsampledImage3D<T>(inHdr, factor, outHdr);
+        else ECHO_ERROR("'%s' is not a label image (integer element type)", inMhdFilename.c_str());
+        });
+    // the following strings are used in musire.sh
+    cout << outHdr.filenameMhd << endl;
+    }
+  return 0;
+  }
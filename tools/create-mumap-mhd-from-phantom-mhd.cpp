@@ -0,0 +1,51 @@
+#include "materials.h"
+
+using namespace std;
+
+int main(int argc, char *argv[])
+  {
+  if (argc != 4 && argc != 5)
+    {
+    cerr << " This program generates a 3D attenuation map (linear attenuation coefficients in 1/cm) for a 3D atlas mhd\n"
+         << " which is accompanied by a Gate-compatible material range list .dat file, at the photon energy of the\n"
+         << " isotope (50 keV ... 1000 keV), from the compositions and densities in gate-materials.db; it replaces the\n"
+         << " MuMap of the Gate MuMapActor (no Gate run needed).\n";
+    cerr << "  USAGE: create-mumap-mhd-from-phantom-mhd <phantomAtlasImage.mhd>\n"
+         << "                                           <phantomMaterialRange.dat>\n"
+         << "                                           <energyKeV>\n"
+         << "                                           [<gate-materials.db>]\n"
+         << "  (default: gate/materials/gate-materials.db of this musire tree)\n";
+    exit(0);
+    }
+  const filesystem::path phantomMhdImageFilename = argv[1];
+  const filesystem::path phantomMaterialRangeFilename = argv[2];
+  const double           energyKeV = atof(argv[3]);
+  const filesystem::path gateMaterialsFilename = (argc == 5) ? argv[4] : GetDefaultGateMaterialDbFilename();
+  // 1. Read mhd phantom image
+  mhdHdr3D hdr = ReadMhdHeader3D(phantomMhdImageFilename);
+  if (hdr.transformMatrix != mhdHdr3D().transformMatrix)
+    ECHO_ERROR("'%s' has a TransformMatrix, materialize it first (orient-mhd -m)", phantomMhdImageFilename.c_str());
+  if (hdr.elementType != MET_UCHAR && hdr.elementType != MET_USHORT)
+    ECHO_ERROR("Voxelized phantom must be MET_UCHAR or MET_USHORT");
+  // 2. Read phantom material range (.dat); mu of a material from its composition and density in gate-materials.db
+  const vector<materialRange> ranges = ReadMaterialRanges(phantomMaterialRangeFilename);
+  const GateMaterialDb materialDb(gateMaterialsFilename);
+  auto mu = [&](const string &material) // 1/cm
+    { return (float)GetLinearAttenuation(materialDb, materialDb.material(material), energyKeV); };
+  // 3. Write mu map mhd image (named as the one of the Gate MuMapActor in musire.sh)
+  filesystem::path muMapMhdImageFilename = phantomMhdImageFilename.stem();
+  muMapMhdImageFilename += "-MuMap.mhd";
+  filesystem::path muMapRawImageFilename = muMapMhdImageFilename.stem();
+  muMapRawImageFilename += ".raw";
+  mhdHdr3D muMapHdr    = hdr;
+  muMapHdr.filenameMhd = muMapMhdImageFilename.string();
+  muMapHdr.filenameRaw = muMapRawImageFilename.string();
+  muMapHdr.elementType = MET_FLOAT;
+  muMapHdr.modality    = "MET_MOD_CT";
+  muMapHdr.compressedData = false; // a plain .raw of floats, also for a .zraw atlas (CASToR reads it as is)
+  if (hdr.elementType == MET_UCHAR) WriteMaterialPropertyImage3D<uint8_t>(hdr, ranges, mu, muMapHdr);
+  else                              WriteMaterialPropertyImage3D<uint16_t>(hdr, ranges, mu, muMapHdr);
+  // the following string is used in musire.sh
+  cout << muMapMhdImageFilename.string() << endl;
+  return 0;
+  }
@@ -2,6 +2,59 @@
 
 using namespace std;
 
+template <typename T> void WritePly(const mhdHdr3D &hdr, const string &inputMhdFilename, const string &outputPlyFilename,
+                                    double cellDiamater, doublexyz halfSize, doublexyz shift)
+  {
+  // 5. get number of cells (=vertex number); the input is streamed in z-slabs (twice), never held as a whole
+  const int slabHeight = GetSlabHeight<T>(hdr);
+  uint64_t cells = 0;
+  MhdSlabReader3D<T> countReader(hdr, slabHeight);
+  while (countReader.next())
+    {
+    const rarray<T,3> &inputSlab = countReader.slab();
+    for (int z = 0; z < countReader.slices(); z++)
+      for (int y = 0; y < hdr.voxels.y; y++)
+        for (int x = 0; x < hdr.voxels.x; x++)
+          if (inputSlab[z][y][x] > 0)
+            cells++;
+    }
+  // 6. write ply header (this is very basic, cell color ist fixed red)
+  ofstream plyFile;
+  plyFile.open (outputPlyFilename);
+  plyFile << "ply\n";
+  plyFile << "format ascii 1.0\n";
+  plyFile << "comment generated from " << inputMhdFilename << "\n";
+  plyFile << "element vertex " << cells << "\n";
+  plyFile << "property float x\n";
+  plyFile << "property float y\n";
+  plyFile << "property float z\n";
+  plyFile << "property uchar red\n";
+  plyFile << "property uchar green\n";
+  plyFile << "property uchar blue\n";
+  plyFile << "end_header\n";
+  // 7. write vertex list
+  MhdSlabReader3D<T> vertexReader(hdr, slabHeight);
+  while (vertexReader.next())
+    {
+    const rarray<T,3> &inputSlab = vertexReader.slab();
+    for (int sz = 0; sz < vertexReader.slices(); sz++)
+      {
+      const double zPos = (vertexReader.z0() + sz) * cellDiamater - halfSize.z + shift.z;
+      for (int y = 0; y < hdr.voxels.y; y++)
+        {
+        const double yPos = y * cellDiamater - halfSize.y + shift.y;
+        for (int x = 0; x < hdr.voxels.x; x++)
+          if (inputSlab[sz][y][x] > 0)
+            {
+            const double xPos = x * cellDiamater - halfSize.x + shift.x;
+            plyFile << xPos << " " << yPos << " " << zPos << " 255 0 0 \n";
+            }
+        }
+      }
+    }
+  plyFile.close();
+  }
+
 int main(int argc, char *argv[])
   {
   if (!(argc == 2 || argc == 3 || argc == 6 || argc == 7))
@@ -34,49 +87,14 @@ int main(int argc, char *argv[])
   const doublexyz halfSize = { 0.5 * hdr.voxelSize.x * hdr.voxels.x, 
                                0.5 * hdr.voxelSize.y * hdr.voxels.y, 
                                0.5 * hdr.voxelSize.z * hdr.voxels.z };
-  // 4. Read input image data
-  rarray<uint64_t,3> inputImage(hdr.voxels.z, hdr.voxels.y, hdr.voxels.x);
-  if      (hdr.elementType == MET_UCHAR)      READ_IMAGE(uint8_t,  hdr, inputImage)
-  else if (hdr.elementType == MET_USHORT)     READ_IMAGE(uint16_t, hdr, inputImage)
-  else if (hdr.elementType == MET_ULONG)      READ_IMAGE(uint32_t, hdr, inputImage)
-  else if (hdr.elementType == MET_ULONG_LONG) READ_IMAGE(uint64_t, hdr, inputImage)
-  // 5. get number of cells (=vertex number)
-  uint64_t cells = 0;
-  for (int z = 0; z < hdr.voxels.z; z++)
-    for (int y = 0; y < hdr.voxels.y; y++)
-      for (int x = 0; x < hdr.voxels.x; x++)
-        if (inputImage[z][y][x] > 0)
-          cells++;
-  // 6. write ply header (this is very basic, cell color ist fixed red)
-  ofstream plyFile;
-  plyFile.open (outputPlyFilename);
-  plyFile << "ply\n";
-  plyFile << "format ascii 1.0\n";
-  plyFile << "comment generated from " << inputMhdFilename << "\n";
-  plyFile << "element vertex " << cells << "\n";
-  plyFile << "property float x\n";
-  plyFile << "property float y\n";
-  plyFile << "property float z\n";
-  plyFile << "property uchar red\n";
-  plyFile << "property uchar green\n";
-  plyFile << "property uchar blue\n";
-  plyFile << "end_header\n";
-  // 7. write vertex list
-  for (int z = 0; z < hdr.voxels.z; z++)
+  // 4. Write ply file (input data are read in their native element type)
+  switch (hdr.elementType)
     {
-    const double zPos = z * cellDiamater - halfSize.z + shift.z;
-    for (int y = 0; y < hdr.voxels.y; y++)
-      {
-      const double yPos = y * cellDiamater - halfSize.y + shift.y;
-      for (int x = 0; x < hdr.voxels.x; x++)
-        if (inputImage[z][y][x] > 0)
-          {
-          const double xPos = x * cellDiamater - halfSize.x + shift.x;
-          plyFile << xPos << " " << yPos << " " << zPos << " 255 0 0 \n";
-          }
-      }
+    case MET_UCHAR:      WritePly<uint8_t>(hdr, inputMhdFilename, outputPlyFilename, cellDiamater, halfSize, shift); break;
+    case MET_USHORT:     WritePly<uint16_t>(hdr, inputMhdFilename, outputPlyFilename, cellDiamater, halfSize, shift); break;
+    case MET_ULONG:      WritePly<uint32_t>(hdr, inputMhdFilename, outputPlyFilename, cellDiamater, halfSize, shift); break;
+    case MET_ULONG_LONG: WritePly<uint64_t>(hdr, inputMhdFilename, outputPlyFilename, cellDiamater, halfSize, shift); break;
+    default: break;
     }
-  plyFile.close();
-  inputImage.clear();
   return 0;
   }
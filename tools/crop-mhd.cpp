@@ -0,0 +1,54 @@
+#include "misc.h"
+
+using namespace std;
+
+// parses "<axis>=[<min>]:[<max>]" (inclusive voxel indices; an empty bound is the image border) into box
+static bool GetCropRange(const string &arg, const mhdHdr3D &hdr, voxelBox3D &box)
+  {
+  const size_t colon = arg.find(':');
+  if (arg.size() < 3 || arg[1] != '=' || arg[0] < 'x' || arg[0] > 'z' || colon == string::npos) return false;
+  const int    axis = arg[0] - 'x';
+  const string minStr = arg.substr(2, colon - 2), maxStr = arg.substr(colon + 1);
+  try
+    {
+    if (!minStr.empty()) box.min[axis] = stoi(minStr);
+    if (!maxStr.empty()) box.max[axis] = stoi(maxStr);
+    }
+  catch (const exception &) { return false; }
+  return 0 <= box.min[axis] && box.min[axis] <= box.max[axis] && box.max[axis] < hdr.voxels[axis];
+  }
+
+int main(int argc, char *argv[])
+  {
+  if (argc < 3)
+    ECHO_ERROR("$ crop-mhd <in.mhd> [x=<min>:<max>] [y=<min>:<max>] [z=<min>:<max>] [-c]\n"
+               "  Writes the voxel box [min, max] (inclusive indices; a missing bound is the image border) to\n"
+               "  <in>-cropped.mhd. A z-range of uncompressed data in one file is not copied: the header refers to\n"
+               "  the input raw data file and skips the slices below min with HeaderSize (-c: copy anyway).");
+  const string inMhdFilename = argv[1];
+  if (!filesystem::exists(inMhdFilename))
+    ECHO_ERROR("'%s' does not exist", inMhdFilename.c_str());
+  const mhdHdr3D inHdr = ReadMhdHeader3D(inMhdFilename);
+  if (inHdr.transformMatrix != mhdHdr3D().transformMatrix)
+    ECHO_ERROR("'%s' has a TransformMatrix, materialize it first (orient-mhd -m)", inMhdFilename.c_str());
+
+  // 1. Box
+  voxelBox3D box = { intxyz(0), inHdr.voxels - intxyz(1) };
+  bool copy = false;
+  for (int i = 2; i < argc; i++)
+    if (strcmp("-c", argv[i]) == 0) copy = true;
+    else if (!GetCropRange(argv[i], inHdr, box))
+      ECHO_ERROR("crop-mhd: invalid range '%s' for DimSize %d %d %d", argv[i], 
+                 inHdr.voxels.x, inHdr.voxels.y, inHdr.voxels.z);
+
+  // 2. Header only (zero copy) or copy of the box
+  mhdHdr3D outHdr = GetDerivedMhdHdr3D(inHdr, "-cropped");
+  if (copy || !GetZeroCopyCroppedMhdHdr3D(inHdr, box, outHdr))
+    VisitElementType(inHdr.elementType, [&](auto tag) 
+      { WriteCroppedImage3D<typename decltype(tag)::type>(inHdr, box, outHdr); });
+  else
+    WriteMhdHeader3D(outHdr);
+  // the following string is used in musire.sh
+  cout << outHdr.filenameMhd << endl;
+  return 0;
+  }
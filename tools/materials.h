@@ -0,0 +1,408 @@
+#ifndef MATERIALS
+#define MATERIALS
+
+#include <map>
+#include <unordered_map>
+#include "misc.h"
+
+// Gate material database (gate/materials/gate-materials.db): the [Elements] (symbol, Z, A) and [Materials] (density
+// and elemental composition) sections, parsed once into flat tables so that tools (density, electron density,
+// attenuation) share one definition of the materials instead of hard-coded lists. Materials and elements are
+// addressed by id (their index in the table, in file order); ids are found by name with one hash lookup.
+
+struct gateElement
+  {
+  char   name[32];
+  char   symbol[4];
+  double Z;
+  double A; // g/mole
+  };
+
+struct gateMaterialComponent
+  {
+  uint32_t element;      // id in the element table
+  double   massFraction; // fractions of a material sum up to 1
+  };
+
+struct gateMaterial
+  {
+  char     name[32];
+  double   density;         // g/cm3
+  double   electronDensity; // electrons/cm3
+  uint32_t firstComponent;  // components [firstComponent, firstComponent + components) of the component table
+  uint32_t components;
+  };
+
+class GateMaterialDb
+  {
+  public:
+    // reads the binary cache of filename if there is one for its content, otherwise parses it and writes the cache
+    explicit GateMaterialDb(const std::string &filename) : filename(filename)
+      {
+      const std::string text  = ReadText();
+      const uint64_t    hash  = Fnv1a64(text);
+      const std::string cache = GetCacheFilename(hash);
+      if (!ReadCache(cache, hash))
+        {
+        Parse(text);
+        WriteCache(cache, hash);
+        }
+      for (size_t m = 0; m < materials.size(); m++) materialIds[materials[m].name] = (int)m;
+      for (size_t e = 0; e < elements.size(); e++)  elementIds[elements[e].name]   = (int)e;
+      }
+    // id of a material (-1 if it is not in the database)
+    int materialId(const std::string &name) const
+      {
+      const auto it = materialIds.find(name);
+      return (it == materialIds.end()) ? -1 : it->second;
+      }
+    int elementId(const std::string &name) const
+      {
+      const auto it = elementIds.find(name);
+      return (it == elementIds.end()) ? -1 : it->second;
+      }
+    const gateMaterial& material(int id) const { return materials[id]; }
+    const gateMaterial& material(const std::string &name) const
+      {
+      const int id = materialId(name);
+      if (id < 0) ECHO_ERROR("Material %s is not in %s", name.c_str(), filename.c_str());
+      return materials[id];
+      }
+    const gateElement& element(int id) const { return elements[id]; }
+    const gateMaterialComponent* components(const gateMaterial &m) const { return &componentTable[m.firstComponent]; }
+    size_t numberOfMaterials() const { return materials.size(); }
+    size_t numberOfElements()  const { return elements.size(); }
+  private:
+    static uint64_t Fnv1a64(const std::string &text)
+      {
+      uint64_t hash = 0xcbf29ce484222325ULL;
+      for (unsigned char c : text) hash = (hash ^ c) * 0x100000001b3ULL;
+      return hash;
+      }
+    // $XDG_CACHE_HOME/musire, ~/.cache/musire or <tmp>/musire; the name holds the content hash, so an edited database
+    // gets a new cache and copies of one database (e.g. in the run directories) share it
+    static std::string GetCacheFilename(uint64_t hash)
+      {
+      const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+      std::filesystem::path dir = (xdg && *xdg)   ? std::filesystem::path(xdg) :
+                                  (home && *home) ? std::filesystem::path(home) / ".cache" :
+                                                    std::filesystem::temp_directory_path();
+      char name[48];
+      snprintf(name, sizeof(name), "gate-materials-%016llx.bin", (unsigned long long)hash);
+      return (dir / "musire" / name).string();
+      }
+    std::string ReadText() const
+      {
+      std::ifstream file(filename, std::ios::binary);
+      if (!file) ECHO_ERROR("Cannot read %s", filename.c_str());
+      std::stringstream text;
+      text << file.rdbuf();
+      return text.str();
+      }
+    // key = value [unit] fields of a line, separated by ';'
+    static std::map<std::string,std::string> GetFields(const std::string &line)
+      {
+      std::map<std::string,std::string> fields;
+      std::stringstream lineStream(line);
+      std::string field;
+      while (getline(lineStream, field, ';'))
+        {
+        const size_t eq = field.find('=');
+        if (eq == std::string::npos) continue;
+        std::string key = field.substr(0, eq), value = field.substr(eq + 1);
+        key.erase(0, key.find_first_not_of(" \t"));
+        key.erase(key.find_last_not_of(" \t") + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t\r") + 1);
+        fields[key] = value;
+        }
+      return fields;
+      }
+    static double GetDensityInGcm3(const std::string &value, int lineNumber)
+      {
+      std::stringstream valueStream(value);
+      double density;
+      std::string unit;
+      if (!(valueStream >> density))
+        ECHO_ERROR("gate-materials.db line %d: invalid density '%s'", lineNumber, value.c_str());
+      valueStream >> unit;
+      if (unit == "g/cm3" || unit.empty()) return density;
+      if (unit == "mg/cm3")                return density * 1e-3;
+      if (unit == "kg/m3")                 return density * 1e-3;
+      ECHO_ERROR("gate-materials.db line %d: unknown density unit '%s'", lineNumber, unit.c_str());
+      }
+    static void CopyName(char *dst, size_t size, const std::string &name, int lineNumber)
+      {
+      if (name.empty() || name.size() >= size)
+        ECHO_ERROR("gate-materials.db line %d: invalid name '%s'", lineNumber, name.c_str());
+      memcpy(dst, name.c_str(), name.size() + 1);
+      }
+    void Parse(const std::string &text)
+      {
+      // 1. Split into elements, materials and their component lines ('+el: name=... ; n=...|f=...')
+      struct componentLine { std::string element; double n, f; int lineNumber; };
+      std::vector<std::vector<componentLine>> componentLines;
+      std::stringstream textStream(text);
+      std::string line, section;
+      for (int lineNumber = 1; getline(textStream, line); lineNumber++)
+        {
+        const size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') continue;
+        if (line[first] == '[') { section = line.substr(first, line.find(']') + 1 - first); continue; }
+        const size_t colon = line.find(':');
+        if (colon == std::string::npos) ECHO_ERROR("%s line %d: '%s'", filename.c_str(), lineNumber, line.c_str());
+        std::string name = line.substr(first, colon - first);
+        name.erase(name.find_last_not_of(" \t") + 1);
+        auto fields = GetFields(line.substr(colon + 1));
+        if (section == "[Elements]")
+          {
+          gateElement e = {};
+          CopyName(e.name, sizeof(e.name), name, lineNumber);
+          CopyName(e.symbol, sizeof(e.symbol), fields["S"], lineNumber);
+          e.Z = atof(fields["Z"].c_str());
+          e.A = atof(fields["A"].c_str());
+          if (e.Z <= 0 || e.A <= 0) ECHO_ERROR("%s line %d: invalid Z or A", filename.c_str(), lineNumber);
+          elements.push_back(e);
+          }
+        else if (section == "[Materials]" && name == "+el")
+          {
+          if (materials.empty()) ECHO_ERROR("%s line %d: element without material", filename.c_str(), lineNumber);
+          std::string element = fields["name"];
+          if (element == "auto") element = materials.back().name;
+          componentLines.back().push_back({ element, fields.count("n") ? atof(fields["n"].c_str()) : 0.0,
+                                            fields.count("f") ? atof(fields["f"].c_str()) : 0.0, lineNumber });
+          }
+        else if (section == "[Materials]" && name[0] != '+')
+          {
+          gateMaterial m = {};
+          CopyName(m.name, sizeof(m.name), name, lineNumber);
+          m.density = GetDensityInGcm3(fields["d"], lineNumber);
+          materials.push_back(m);
+          componentLines.emplace_back();
+          }
+        else
+          ECHO_ERROR("%s line %d: '%s' is not supported", filename.c_str(), lineNumber, line.c_str());
+        }
+      // 2. Resolve the components to mass fractions (from numbers of atoms or normalized fractions by mass)
+      std::unordered_map<std::string,int> ids;
+      for (size_t e = 0; e < elements.size(); e++) ids[elements[e].name] = (int)e;
+      constexpr double avogadro = 6.02214076e23; // 1/mole
+      for (size_t m = 0; m < materials.size(); m++)
+        {
+        materials[m].firstComponent = componentTable.size();
+        materials[m].components     = componentLines[m].size();
+        double sum = 0.0;
+        for (const componentLine &c : componentLines[m])
+          {
+          const auto it = ids.find(c.element);
+          if (it == ids.end())
+            ECHO_ERROR("%s line %d: element %s is not defined", filename.c_str(), c.lineNumber, c.element.c_str());
+          const double massFraction = (c.f > 0.0 || c.n == 0.0) ? c.f : c.n * elements[it->second].A;
+          componentTable.push_back({ (uint32_t)it->second, massFraction });
+          sum += massFraction;
+          }
+        double electronsPerGram = 0.0;
+        for (uint32_t c = materials[m].firstComponent; c < componentTable.size(); c++)
+          {
+          componentTable[c].massFraction /= (sum > 0.0) ? sum : 1.0;
+          const gateElement &e = elements[componentTable[c].element];
+          electronsPerGram += componentTable[c].massFraction * e.Z / e.A * avogadro;
+          }
+        materials[m].electronDensity = materials[m].density * electronsPerGram;
+        }
+      }
+    // binary cache: magic, hash, table sizes, then the three tables as they are in memory. The cache may sit in a
+    // shared directory, so it is only used if its sizes match the file, its names are terminated and its component
+    // and element ids are in range; otherwise the database is parsed (and the cache rewritten).
+    static constexpr uint64_t cacheMagic = 0x31424454414d534dULL; // "MSMATDB1"
+    static constexpr uint64_t maxCacheEntries = 1 << 20; // per table, far more than gate-materials.db holds
+    bool ReadCache(const std::string &cache, uint64_t hash)
+      {
+      std::ifstream file(cache, std::ios::binary);
+      uint64_t header[5];
+      if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != cacheMagic || header[1] != hash)
+        return false;
+      if (header[2] > maxCacheEntries || header[3] > maxCacheEntries || header[4] > maxCacheEntries)
+        return false;
+      std::error_code error;
+      const uint64_t bytes = sizeof(header) + header[2] * sizeof(gateElement) + header[3] * sizeof(gateMaterial) + 
+                             header[4] * sizeof(gateMaterialComponent);
+      if (std::filesystem::file_size(cache, error) != bytes || error) return false;
+      elements.resize(header[2]);
+      materials.resize(header[3]);
+      componentTable.resize(header[4]);
+      file.read(reinterpret_cast<char*>(elements.data()), elements.size() * sizeof(gateElement));
+      file.read(reinterpret_cast<char*>(materials.data()), materials.size() * sizeof(gateMaterial));
+      file.read(reinterpret_cast<char*>(componentTable.data()), 
+                componentTable.size() * sizeof(gateMaterialComponent));
+      if (file && IsValidCache()) return true;
+      elements.clear(), materials.clear(), componentTable.clear();
+      return false;
+      }
+    bool IsValidCache() const
+      {
+      auto terminated = [](const char *name, size_t size) { return memchr(name, '\0', size) != nullptr; };
+      for (const gateElement &e : elements)
+        if (!terminated(e.name, sizeof(e.name)) || !terminated(e.symbol, sizeof(e.symbol))) return false;
+      for (const gateMaterial &m : materials)
+        if (!terminated(m.name, sizeof(m.name)) || 
+            (uint64_t)m.firstComponent + m.components > componentTable.size()) return false;
+      for (const gateMaterialComponent &c : componentTable)
+        if (c.element >= elements.size()) return false;
+      return true;
+      }
+    // written to a temporary file that is renamed, so concurrent runs never read a partial cache; a cache that
+    // cannot be written is not an error (the database is parsed again next time)
+    void WriteCache(const std::string &cache, uint64_t hash) const
+      {
+      std::error_code error;
+      std::filesystem::create_directories(std::filesystem::path(cache).parent_path(), error);
+      const std::string tmp = cache + "." + std::to_string(getpid());
+      std::ofstream file(tmp, std::ios::binary);
+      const uint64_t header[5] = { cacheMagic, hash, elements.size(), materials.size(), componentTable.size() };
+      file.write(reinterpret_cast<const char*>(header), sizeof(header));
+      file.write(reinterpret_cast<const char*>(elements.data()), elements.size() * sizeof(gateElement));
+      file.write(reinterpret_cast<const char*>(materials.data()), materials.size() * sizeof(gateMaterial));
+      file.write(reinterpret_cast<const char*>(componentTable.data()), 
+                 componentTable.size() * sizeof(gateMaterialComponent));
+      file.close();
+      if (file) std::filesystem::rename(tmp, cache, error);
+      if (!file || error) std::filesystem::remove(tmp, error);
+      }
+    const std::string                    filename;
+    std::vector<gateElement>             elements;
+    std::vector<gateMaterial>            materials;
+    std::vector<gateMaterialComponent>   componentTable;
+    std::unordered_map<std::string,int>  materialIds, elementIds;
+  };
+
+// label ranges of a Gate material range file (.dat): a line "<first label> <last label> <material>" per range; the
+// first line (number of ranges), comments ('#') and lines that do not start like that are skipped
+struct materialRange
+  {
+  int         labelStart, labelEnd;
+  std::string material;
+  };
+
+inline std::vector<materialRange> ReadMaterialRanges(const std::string &filename)
+  {
+  std::ifstream file(filename);
+  if (!file) ECHO_ERROR("Cannot read %s", filename.c_str());
+  std::vector<materialRange> ranges;
+  std::string line;
+  while (getline(file, line))
+    {
+    if (line.length() < 3 || line[0] == '#') continue; // line is too short or starts with '#'
+    std::stringstream lineStream(line);
+    materialRange range;
+    if (lineStream >> range.labelStart >> range.labelEnd >> range.material) ranges.push_back(range);
+    }
+  return ranges;
+  }
+
+// Klein-Nishina cross section per electron [cm2] for a photon of energy [keV]
+inline double GetKleinNishinaCrossSection(double energyKeV)
+  {
+  const double re = 2.8179403262e-13 /*cm*/, k = energyKeV / 510.99895, l = std::log(1 + 2 * k);
+  return 2 * M_PI * re * re * ((1 + k) / (k * k) * (2 * (1 + k) / (1 + 2 * k) - l / k) + l / (2 * k) 
+                               - (1 + 3 * k) / ((1 + 2 * k) * (1 + 2 * k)));
+  }
+
+// Photon mass attenuation coefficient mu/rho [cm2/g] (total, with coherent scattering) of element Z (atomic mass A
+// [g/mole]) at 50 keV <= energy <= 1000 keV, the range of the SPECT and PET isotopes (no pair production). A compact
+// table holds the NIST XCOM values (Hubbell & Seltzer) of the anchor elements, interpolated log-log in energy; K
+// edges in the range are listed twice (below, above). An element between anchors is Klein-Nishina scattering by its
+// Z electrons times 1 + x, x (photoelectric and coherent part, binding) interpolated in log x - log Z between the
+// anchors (x grows about as Z^3 per electron); this holds as long as the K edge is below 50 keV (Z <= 60). Heavier 
+// elements must be anchors.
+inline double GetPhotonMassAttenuation(int Z, double A, double energyKeV)
+  {
+  struct anchorElement { int Z; double A; std::vector<std::pair<double,double>> muRho; /* (keV, cm2/g) */ };
+  static const std::vector<anchorElement> anchors = 
+    {
+    { 1, 1.008,   {{50, 0.3355}, {60, 0.3260}, {80, 0.3091}, {100, 0.2944}, {150, 0.2651}, {200, 0.2429}, 
+                   {300, 0.2112}, {400, 0.1893}, {500, 0.1729}, {600, 0.1599}, {800, 0.1405}, {1000, 0.1263}}},
+    { 6, 12.011,  {{50, 0.1871}, {60, 0.1753}, {80, 0.1610}, {100, 0.1514}, {150, 0.1347}, {200, 0.1229}, 
+                   {300, 0.1066}, {400, 0.09546}, {500, 0.08715}, {600, 0.08058}, {800, 0.07076}, {1000, 0.06361}}},
+    { 7, 14.007,  {{50, 0.1980}, {60, 0.1817}, {80, 0.1639}, {100, 0.1529}, {150, 0.1353}, {200, 0.1233}, 
+                   {300, 0.1068}, {400, 0.09557}, {500, 0.08719}, {600, 0.08063}, {800, 0.07081}, {1000, 0.06364}}},
+    { 8, 15.999,  {{50, 0.2132}, {60, 0.1907}, {80, 0.1678}, {100, 0.1551}, {150, 0.1361}, {200, 0.1237}, 
+                   {300, 0.1070}, {400, 0.09566}, {500, 0.08729}, {600, 0.08070}, {800, 0.07087}, {1000, 0.06372}}},
+    {13, 26.982,  {{50, 0.3681}, {60, 0.2778}, {80, 0.2018}, {100, 0.1704}, {150, 0.1378}, {200, 0.1223}, 
+                   {300, 0.1042}, {400, 0.09276}, {500, 0.08445}, {600, 0.07802}, {800, 0.06841}, {1000, 0.06146}}},
+    {14, 28.086,  {{50, 0.4385}, {60, 0.3207}, {80, 0.2228}, {100, 0.1835}, {150, 0.1448}, {200, 0.1275}, 
+                   {300, 0.1082}, {400, 0.09614}, {500, 0.08748}, {600, 0.08077}, {800, 0.07082}, {1000, 0.06361}}},
+    {26, 55.845,  {{50, 1.958}, {60, 1.205}, {80, 0.5952}, {100, 0.3717}, {150, 0.1964}, {200, 0.1460}, 
+                   {300, 0.1099}, {400, 0.09400}, {500, 0.08414}, {600, 0.07704}, {800, 0.06699}, {1000, 0.05995}}},
+    {29, 63.546,  {{50, 2.613}, {60, 1.593}, {80, 0.7630}, {100, 0.4584}, {150, 0.2217}, {200, 0.1559}, 
+                   {300, 0.1119}, {400, 0.09413}, {500, 0.08362}, {600, 0.07625}, {800, 0.06605}, {1000, 0.05901}}},
+    {53, 126.904, {{50, 12.32}, {60, 7.579}, {80, 3.510}, {100, 1.942}, {150, 0.6978}, {200, 0.3663}, 
+                   {300, 0.1771}, {400, 0.1217}, {500, 0.09701}, {600, 0.08337}, {800, 0.06813}, {1000, 0.05932}}},
+    {74, 183.84,  {{50, 5.949}, {60, 3.713}, {69.525, 2.552}, {69.525, 11.23}, {80, 7.810}, {100, 4.438}, 
+                   {150, 1.581}, {200, 0.7844}, {300, 0.3238}, {400, 0.1925}, {500, 0.1378}, {600, 0.1093}, 
+                   {800, 0.08066}, {1000, 0.06618}}},
+    {82, 207.2,   {{50, 8.041}, {60, 5.021}, {80, 2.419}, {88.0045, 1.910}, {88.0045, 7.683}, {100, 5.549}, 
+                   {150, 2.014}, {200, 0.9985}, {300, 0.4031}, {400, 0.2323}, {500, 0.1614}, {600, 0.1248}, 
+                   {800, 0.08870}, {1000, 0.07102}}},
+    };
+  if (energyKeV < 50 || energyKeV > 1000)
+    ECHO_ERROR("Photon energy %g keV is outside of the attenuation table (50 keV ... 1000 keV)", energyKeV);
+  auto muRho = [energyKeV](const anchorElement &a)
+    {
+    size_t i = 1;
+    while (i < a.muRho.size() - 1 && a.muRho[i].first < energyKeV) i++; // above an edge at energy
+    const auto &p = a.muRho[i-1], &q = a.muRho[i];
+    return p.second * std::pow(q.second / p.second, std::log(energyKeV / p.first) / std::log(q.first / p.first));
+    };
+  auto excess = [&](const anchorElement &a) 
+    { return muRho(a) / (6.02214076e23 * a.Z / a.A * GetKleinNishinaCrossSection(energyKeV)) - 1; };
+  for (const anchorElement &a : anchors)
+    if (a.Z == Z) return muRho(a);
+  if (Z < 2 || Z > 60)
+    ECHO_ERROR("Element Z = %d is not in the photon attenuation table (needed for Z > 60, K edge above 50 keV)", Z);
+  // the two anchors around Z (C and N below carbon, Cu and I above iodine) with their K edge below 50 keV
+  size_t hi = 2;
+  while (hi < 8 && anchors[hi].Z < Z) hi++;
+  const anchorElement &a = anchors[hi-1], &b = anchors[hi];
+  const double x = excess(a) * std::pow(excess(b) / excess(a), std::log((double)Z / a.Z) / std::log((double)b.Z / a.Z));
+  return 6.02214076e23 * Z / A * GetKleinNishinaCrossSection(energyKeV) * (1 + x);
+  }
+
+// linear attenuation coefficient [1/cm] of a material at energy [keV] from its density and composition
+inline double GetLinearAttenuation(const GateMaterialDb &db, const gateMaterial &m, double energyKeV)
+  {
+  double muRho = 0.0;
+  for (uint32_t c = 0; c < m.components; c++)
+    {
+    const gateMaterialComponent &component = db.components(m)[c];
+    const gateElement &e = db.element(component.element);
+    if (component.massFraction > 0.0) muRho += component.massFraction * GetPhotonMassAttenuation(e.Z, e.A, energyKeV);
+    }
+  return m.density * muRho;
+  }
+
+// Writes the image (float) of a property of the materials of the label image of atlasHdr (type T) to outHdr, e.g. 
+// their density; property(material name) is evaluated once per range of the range file, not per voxel
+template <typename T, typename F> 
+void WriteMaterialPropertyImage3D(const mhdHdr3D &atlasHdr, const std::vector<materialRange> &ranges, F property,
+                                  const mhdHdr3D &outHdr)
+  {
+  LabelLut<T,float> lut;
+  for (const materialRange &range : ranges)
+    {
+    const float value = property(range.material);
+    for (int64_t label = range.labelStart; label <= range.labelEnd; label++)
+      lut.set(label, value);
+    }
+  WriteLabelLutImage3D(atlasHdr, lut, outHdr);
+  }
+
+// gate/materials/gate-materials.db of the musire tree the running tool belongs to (tools/<tool>)
+inline std::string GetDefaultGateMaterialDbFilename()
+  {
+  std::error_code error;
+  const std::filesystem::path exe = std::filesystem::read_symlink("/proc/self/exe", error);
+  return (exe.parent_path().parent_path() / "gate" / "materials" / "gate-materials.db").string();
+  }
+
+#endif // MATERIALS
@@ -0,0 +1,93 @@
+#include "misc.h"
+
+using namespace std;
+
+// sets key (or only its index-th list element if index >= 0) to value; an empty value removes the key
+static void EditKeyValue(mhdKeyValues &keyValues, const string &key, int index, const string &value, 
+                         const string &mhdFilename)
+  {
+  auto keyValue = find_if(keyValues.begin(), keyValues.end(), [&](const auto &kv) { return kv.first == key; });
+  if (index >= 0)
+    {
+    if (keyValue == keyValues.end()) ECHO_ERROR("'%s' has no key '%s'", mhdFilename.c_str(), key.c_str());
+    stringstream linestream(keyValue->second);
+    vector<string> items;
+    string item;
+    while (linestream >> item) items.push_back(item);
+    if (index >= (int)items.size() || value.empty()) 
+      ECHO_ERROR("'%s' has no element %s[%d] to be set", mhdFilename.c_str(), key.c_str(), index);
+    items[index] = value;
+    keyValue->second = items[0];
+    for (size_t i = 1; i < items.size(); i++) keyValue->second += " " + items[i];
+    }
+  else if (key == "ElementDataFile" && keyValue != keyValues.end() && value.rfind("LIST", 0) != 0)
+    {
+    // the lines after ElementDataFile = LIST are its file list, which a single data file replaces
+    keyValues.erase(keyValue + 1, keyValues.end());
+    if (value.empty()) keyValues.pop_back();
+    else               keyValues.back().second = value;
+    }
+  else if (value.empty())
+    {
+    if (keyValue != keyValues.end()) keyValues.erase(keyValue);
+    }
+  else if (keyValue != keyValues.end())
+    keyValue->second = value;
+  else
+    {
+    auto dataFile = find_if(keyValues.begin(), keyValues.end(), 
+                            [](const auto &kv) { return kv.first == "ElementDataFile"; });
+    keyValues.insert(dataFile, { key, value });
+    }
+  }
+
+int main(int argc, char *argv[])
+  {
+  if (argc < 3)
+    ECHO_ERROR("$ mhd-edit <file.mhd> [<file.mhd> ...] <Key=Value> [<Key=Value> ...]\n"
+               "  Sets several header keys in one atomic rewrite of each <file.mhd>, e.g.\n"
+               "    mhd-edit phantom.mhd \"DimSize=512 512 100\" \"ElementDataFile=phantom-cropped.raw\" Offset=\n"
+               "  'Key=' removes the key, 'Key[i]=Value' sets only the i-th element of a list (e.g. DimSize[2]=100).\n"
+               "  New keys are inserted before ElementDataFile, which MetaIO expects last. Comments and the file\n"
+               "  list of ElementDataFile = LIST are kept as they are.");
+  // 1. Split arguments into header files and edits
+  vector<string> mhdFilenames;
+  vector<tuple<string, int, string>> edits; // key, list index (-1 for the whole value), value
+  for (int i = 1; i < argc; i++)
+    {
+    const string arg = argv[i];
+    const size_t equal = arg.find('=');
+    if (equal == string::npos)
+      {
+      if (!edits.empty()) ECHO_ERROR("Header file '%s' given after the first Key=Value", argv[i]);
+      if (!filesystem::exists(arg)) ECHO_ERROR("'%s' does not exist", argv[i]);
+      mhdFilenames.push_back(arg);
+      continue;
+      }
+    string key = TrimSpaces(arg.substr(0, equal));
+    int index = -1;
+    const size_t bracket = key.find('[');
+    if (bracket != string::npos)
+      {
+      if (key.back() != ']') ECHO_ERROR("'%s' is not of the form Key[i]=Value", argv[i]);
+      index = stoi(key.substr(bracket + 1, key.size() - bracket - 2));
+      key   = key.substr(0, bracket);
+      }
+    if (key.empty()) ECHO_ERROR("'%s' is not of the form Key=Value", argv[i]);
+    edits.push_back({ key, index, TrimSpaces(arg.substr(equal + 1)) });
+    }
+  if (mhdFilenames.empty() || edits.empty()) ECHO_ERROR("Need at least one header file and one Key=Value");
+  // 2. Apply all edits to each header and replace it atomically
+  for (const string &mhdFilename : mhdFilenames)
+    {
+    mhdKeyValues keyValues = ReadMhdKeyValues(mhdFilename);
+    for (const auto &keyValue : keyValues)
+      if (keyValue.first == "ElementDataFile" && keyValue.second == "LOCAL")
+        ECHO_ERROR("'%s' holds its data (ElementDataFile = LOCAL), which mhd-edit cannot rewrite", 
+                   mhdFilename.c_str());
+    for (const auto &[key, index, value] : edits)
+      EditKeyValue(keyValues, key, index, value, mhdFilename);
+    WriteMhdKeyValues(mhdFilename, keyValues);
+    }
+  return 0;
+  }
@@ -0,0 +1,86 @@
+#include "misc.h"
+
+using namespace std;
+
+// header keys whose values are lists of numbers; they become bash arrays
+static const vector<string> arrayKeys = { "DimSize", "ElementSize", "ElementSpacing", "Offset", "Origin", "Position",
+                                          "TransformMatrix", "Rotation", "Orientation", "CenterOfRotation",
+                                          "ElementDataPaths" };
+
+static bool IsShellName(const string &str)
+  {
+  if (str.empty() || !(isalpha(str[0]) || str[0] == '_')) return false;
+  for (char c : str)
+    if (!(isalnum(c) || c == '_')) return false;
+  return true;
+  }
+
+static string ShellQuoted(const string &str)
+  {
+  string quoted = "'";
+  for (char c : str)
+    quoted += (c == '\'') ? string("'\\''") : string(1, c);
+  return quoted + "'";
+  }
+
+int main(int argc, char *argv[])
+  {
+  if (argc != 2 && !(argc == 4 && strcmp("-p", argv[2]) == 0))
+    ECHO_ERROR("$ mhd-info <in.mhd> [-p <prefix>]\n"
+               "  Prints all header fields as bash declarations, e.g. inside a function\n"
+               "    eval \"$(mhd-info phantom.mhd)\"; local -i dimX=${DimSize[0]}\n"
+               "  declares local variables DimSize=(x y z), ElementSize=(x y z), ElementType, ElementDataFile, ... .\n"
+               "  Number lists become arrays, all other values strings. ElementSize falls back to ElementSpacing,\n"
+               "  and ElementDataPath holds the data file path as seen from the current directory (ElementDataPaths\n"
+               "  all data files, also those of a LIST or file name pattern).");
+  const string inMhdFilename = argv[1];
+  if (!filesystem::exists(inMhdFilename))
+    ECHO_ERROR("'%s' does not exist", inMhdFilename.c_str());
+  const string prefix = (argc == 4) ? argv[3] : "";
+
+  // 1. Check the header and read all key value pairs
+  const mhdHdr3D hdr = ReadMhdHeader3D(inMhdFilename);
+  mhdKeyValues keyValues = ReadMhdKeyValues(inMhdFilename);
+  // 2. Add derived fields
+  auto find = [&](const string &key)
+    {
+    return find_if(keyValues.begin(), keyValues.end(), [&](const auto &kv) { return kv.first == key; });
+    };
+  if (find("ElementSize") == keyValues.end() && find("ElementSpacing") != keyValues.end())
+    keyValues.push_back({ "ElementSize", find("ElementSpacing")->second });
+  const filesystem::path mhdDir = filesystem::path(inMhdFilename).parent_path();
+  auto path = [&](const filesystem::path &rawPath)
+    { return (rawPath.is_absolute() || mhdDir.empty()) ? rawPath.string() : (mhdDir / rawPath).string(); };
+  if (!hdr.filenameRaw.empty() && hdr.filenameRaw != "LOCAL" && hdr.filenameRaw != "LIST")
+    keyValues.push_back({ "ElementDataPath", path(hdr.filenameRaw) });
+  if (!hdr.filenameRaw.empty() && hdr.filenameRaw != "LOCAL")
+    {
+    string paths;
+    for (const string &filenameRaw : GetMhdRawFilenames(hdr))
+      paths += (paths.empty() ? "" : " ") + path(filenameRaw);
+    keyValues.push_back({ "ElementDataPaths", paths });
+    }
+  // 3. Print them as bash declarations
+  for (const auto &keyValue : keyValues)
+    {
+    const string name = prefix + keyValue.first;
+    if (keyValue.first.empty() || !IsShellName(name)) continue; // comments and the LIST file names
+    if (find_if(arrayKeys.begin(), arrayKeys.end(), [&](const string &key) { return key == keyValue.first; }) 
+        != arrayKeys.end())
+      {
+      cout << "declare -a " << name << "=(";
+      stringstream linestream(keyValue.second);
+      string item;
+      bool first = true;
+      while (linestream >> item)
+        {
+        cout << (first ? "" : " ") << ShellQuoted(item);
+        first = false;
+        }
+      cout << ")\n";
+      }
+    else
+      cout << "declare " << name << "=" << ShellQuoted(keyValue.second) << "\n";
+    }
+  return 0;
+  }
@@ -1,86 +1,38 @@
-#include "/home/jpeter/cpp/include/jp.h"
-#include "/home/jpeter/cpp/include/jp-mhd.h"
+#include "misc.h"
 
 using namespace std;
 
-#define MIRROR_IMAGE(TYPE) \
-  { \
-  rarray<TYPE,3> inImage(inHdr.voxels.z, inHdr.voxels.y, inHdr.voxels.x); \
-  ReadMhdImage3D(inHdr, &inImage); \
-  outHdr.filenameMhd = inMhdFilename.substr(0, inMhdFilename.find_last_of('.')) + str + ".mhd"; \
-  outHdr.filenameRaw = inHdr.filenameRaw.substr(0, inHdr.filenameRaw.find_last_of('.')) + str + \
-                       filesystem::path(inHdr.filenameRaw).extension().string(); \
-  outHdr.elementType = inHdr.elementType; \
-  outHdr.modality    = inHdr.modality; \
-  outHdr.voxels      = { inHdr.voxels.x,       inHdr.voxels.y,       inHdr.voxels.z }; \
-  outHdr.voxelSize   = { inHdr.voxelSize.x,    inHdr.voxelSize.y,    inHdr.voxelSize.z }; \
-  rarray<TYPE,3> outImage(outHdr.voxels.z, outHdr.voxels.y, outHdr.voxels.x); \
-  switch (mirror) \
-    { \
-    case X: \
-      { \
-      for (int z = 0; z < outHdr.voxels.z; z++) \
-        for (int y = 0; y < outHdr.voxels.y; y++) \
-          for (int x = 0; x < outHdr.voxels.x; x++) \
-            outImage[z][y][x] = inImage[z][y][outHdr.voxels.x-1-x]; \
-      } \
-    break; \
-    case Y: \
-      { \
-      for (int z = 0; z < outHdr.voxels.z; z++) \
-        for (int y = 0; y < outHdr.voxels.y; y++) \
-          for (int x = 0; x < outHdr.voxels.x; x++) \
-            outImage[z][y][x] = inImage[z][outHdr.voxels.y-1-y][x]; \
-      } \
-    break; \
-    case Z: \
-      { \
-      for (int z = 0; z < outHdr.voxels.z; z++) \
-        for (int y = 0; y < outHdr.voxels.y; y++) \
-          for (int x = 0; x < outHdr.voxels.x; x++) \
-            outImage[z][y][x] = inImage[outHdr.voxels.z-1-z][y][x]; \
-      } \
-    break; \
-    } \
-  WriteMhd3DImage(outHdr, outImage); \
-  cout << "Wrote ' " << outHdr.filenameMhd << " '\n"; \
-  }
-
-enum mirrorEnum { X, Y, Z };
-
 int main(int argc, char *argv[])
   {
-  if (argc != 3) 
-    ECHO_ERROR("$ mirror-mhd-image <in.mhd> < -x | -y | -z >");
+  const bool inPlace = (argc > 1 && strcmp("-i", argv[1]) == 0);
+  const bool lazy    = (argc > 1 && strcmp("-l", argv[1]) == 0);
+  const int  first   = (inPlace || lazy) ? 2 : 1; // first input file argument
+  if (argc < first + 2) 
+    ECHO_ERROR("$ mirror-mhd-image [-i|-l] <in.mhd> [<in.mhd> ...] < -x | -y | -z >\n"
+               "  Several images (e.g. a glob) are mirrored concurrently in one process. With -i the raw data\n"
+               "  files are mirrored in place (no new files, no second image in memory); a raw data file that may be\n"
+               "  shared (HeaderSize, larger than the image) is refused. With -l only a header is written\n"
+               "  that records the mirror in TransformMatrix and refers to the input raw data.");
 
-  const string inMhdFilename = argv[1];
-  if (!filesystem::exists(inMhdFilename)) 
-    ECHO_ERROR("'%s' does not exist", inMhdFilename.c_str());
-
-  mirrorEnum mirror;
+  axisPermutation3D mirror;
   string str;
-  if      (strcmp( "-x", argv[2]) == 0) { mirror = X;  str = "-x-mirrored"; }
-  else if (strcmp( "-y", argv[2]) == 0) { mirror = Y;  str = "-y-mirrored"; }
-  else if (strcmp( "-z", argv[2]) == 0) { mirror = Z;  str = "-z-mirrored"; }
-  else
-    ECHO_ERROR("$ mirror-mhd-image <in.mhd> < -x | -y | -z >");
+  if (!GetMirrorAxisPermutation3D(argv[argc-1], mirror, str))
+    ECHO_ERROR("$ mirror-mhd-image [-i|-l] <in.mhd> [<in.mhd> ...] < -x | -y | -z >");
+  const vector<string> inMhdFilenames(argv + first, argv + argc - 1);
+  for (const string &inMhdFilename : inMhdFilenames)
+    if (!filesystem::exists(inMhdFilename)) 
+      ECHO_ERROR("'%s' does not exist", inMhdFilename.c_str());
 
-  mhdHdr3D inHdr = ReadMhdHeader3D(inMhdFilename);
-  mhdHdr3D outHdr;
-  switch (inHdr.elementType)
-    {
-    case MET_UCHAR:      MIRROR_IMAGE(unsigned char); break;
-    case MET_SHORT:      MIRROR_IMAGE(short); break;
-    case MET_USHORT:     MIRROR_IMAGE(unsigned short); break;
-    case MET_LONG:       MIRROR_IMAGE(long); break;
-    case MET_ULONG:      MIRROR_IMAGE(unsigned long); break;
-    case MET_LONG_LONG:  MIRROR_IMAGE(long long); break;
-    case MET_ULONG_LONG: MIRROR_IMAGE(unsigned long long); break;
-    case MET_FLOAT:      MIRROR_IMAGE(float); break;
-    case MET_DOUBLE:     MIRROR_IMAGE(double); break;
-    default: EchoExit(" Element type of file '" + inHdr.filenameRaw + "' not supported");
-    }
-  // the following string is used in musire.sh
-  cout << outHdr.filenameMhd << endl; // can use return value in bash
+  vector<string> outMhdFilenames = inMhdFilenames;
+  if (inPlace)
+    ParallelFor(0, inMhdFilenames.size(), [&](size_t i)
+      { MirrorMhdImageInPlace(ReadMhdHeader3D(inMhdFilenames[i]), argv[argc-1][1] - 'x'); });
+  else if (lazy)
+    outMhdFilenames = WriteLazilyPermutedMhdHeaders3D(inMhdFilenames, mirror, str);
+  else
+    outMhdFilenames = WritePermutedImages3D(inMhdFilenames, mirror, str);
+  // the following strings are used in musire.sh
+  for (const string &outMhdFilename : outMhdFilenames)
+    cout << outMhdFilename << endl; // can use return value in bash
   return 0;
   }
@@ -2,18 +2,26 @@
 #define MISC
 
 #  include <algorithm>
+#  include <array>
+#  include <atomic>
 #  include <chrono>
 #  include <math.h>
 #  include <cmath>
+#  include <condition_variable>
 #  include <cstdarg>
+#  include <deque>
 #  include <cstdint>
 #  include <cstdio>
 #  include <cstdlib>
 #  include <filesystem>
 #  include <fstream>
+#  include <future>
 #  include <iostream>
+#  include <limits>
 #  include <thread>
+#  include <type_traits>
 #  include <mutex>
+#  include <numeric>
 #  include <filesystem>
 #  include <memory>
 #  include <sstream>
@@ -21,13 +29,20 @@
 #  include <string.h>
 #  include <sstream>
 #  include <utility>
+#  include <variant>
 #  include <vector>
 #  include <unistd.h>
 #  include <sys/sysinfo.h>
 #  include <sys/stat.h>
+#  include <sys/mman.h>
+#  include <fcntl.h>
 #  include <limits.h>
 #  include <float.h>
 #  include <iomanip>
+#  include <zlib.h>
+#  if defined(__x86_64__) || defined(__i386__)
+#    include <immintrin.h>
+#  endif
 #  include "rarray"
 #  include "rarrayio"
 
@@ -55,6 +70,31 @@ typedef uint16_t word;
 typedef uint32_t dword;
 typedef uint64_t qword;
 
+// threads that a ParallelFor called on this thread may use (0: all hardware threads); the workers of a ParallelFor
+// share its threads, so nested calls (e.g. per-slab kernels inside per-file workers) do not oversubscribe
+inline thread_local unsigned parallelForThreads = 0;
+
+// calls f(i) for every i in [begin, end) on all (available) hardware threads; items are handed out one by one, so 
+// an item should be a sizeable piece of work (a slab, a chunk)
+template <typename F> void ParallelFor(size_t begin, size_t end, F f, unsigned threads = 0)
+  {
+  if (end <= begin) return;
+  const unsigned available = parallelForThreads ? parallelForThreads 
+                                                : std::max(1u, std::thread::hardware_concurrency());
+  if (threads == 0) threads = available;
+  threads = (unsigned)std::min<size_t>(threads, end - begin);
+  if (threads == 1) { for (size_t i = begin; i < end; i++) f(i); return; }
+  std::atomic<size_t>      next(begin);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; t++)
+    workers.emplace_back([&]() 
+      { 
+      parallelForThreads = std::max(1u, available / threads);
+      for (size_t i = next++; i < end; i = next++) f(i); 
+      });
+  for (auto &worker : workers) worker.join();
+  }
+
 template<typename T> class VectorXYZ
   {
   public:
@@ -108,6 +148,15 @@ typedef VectorXYZ<double> doublexyz;
 enum   elementTypes { MET_UCHAR, MET_SHORT, MET_USHORT, MET_LONG, MET_ULONG, MET_LONG_LONG, MET_ULONG_LONG,
                       MET_FLOAT, MET_DOUBLE, MET_NONE };
 static size_t elementTypeSize[] = { 1, 2, 2, 4, 4, 8, 8, 4, 8, 0 };
+static const char *elementTypeNames[] = { "MET_UCHAR", "MET_SHORT", "MET_USHORT", "MET_LONG", "MET_ULONG", 
+                                          "MET_LONG_LONG", "MET_ULONG_LONG", "MET_FLOAT", "MET_DOUBLE", "MET_NONE" };
+
+static std::string TrimSpaces(const std::string &str)
+  {
+  const size_t first = str.find_first_not_of(" \t\r");
+  if (first == std::string::npos) return "";
+  return str.substr(first, str.find_last_not_of(" \t\r") - first + 1);
+  }
 
 static void CheckObjectType(std::stringstream &linestream, std::string &item)
   {
@@ -119,15 +168,19 @@ static void CheckBinaryData(std::stringstream &linestream, std::string &item)
   while (getline(linestream, item, ' '));
   if (item.compare("True") != 0) EchoExit(" inaryData needs to be 'True'");
   }
-static void CheckBinaryDataByteOrderMSB(std::stringstream &linestream, std::string &item)
+static bool GetBinaryDataByteOrderMSB(std::stringstream &linestream, std::string &item)
   {
   while (getline(linestream, item, ' '));
-  if (item.compare("False") != 0) EchoExit(" BinaryDataByteOrderMSB needs to be 'False'"); // TODO what if true?
+  if (item.compare("True") != 0 && item.compare("False") != 0) 
+    EchoExit(" BinaryDataByteOrderMSB needs to be 'True' or 'False'");
+  return item.compare("True") == 0;
   }
-static void CheckCompressedData(std::stringstream &linestream, std::string &item)
+static bool GetCompressedData(std::stringstream &linestream, std::string &item)
   {
   while (getline(linestream, item, ' '));
-  if (item.compare("False") != 0) EchoExit(" CompressedData needs to be 'False'"); // TODO what if true?
+  if (item.compare("True") != 0 && item.compare("False") != 0) 
+    EchoExit(" CompressedData needs to be 'True' or 'False'");
+  return item.compare("True") == 0;
   }
 static void CheckNdims(std::stringstream &linestream, std::string &item, int dim)
   {
@@ -140,10 +193,41 @@ static void CheckNdims(std::stringstream &linestream, std::string &item, int dim
 //  // no checking at this time
 //  return item;
 //  }
-static std::string GetElementDataFile(std::stringstream &linestream, std::string &item)
+static void GetValues(std::stringstream &linestream, const std::string &key, double *values, int n)
   {
-  while (getline(linestream, item, ' '));
-  return item;
+  for (int i = 0; i < n; i++)
+    if (!(linestream >> values[i])) EchoExit(" " + key + " needs " + std::to_string(n) + " values");
+  }
+// ElementDataFile is either a single file, 'LIST [2D]' followed by one file per line (read from ifFile), or a
+// printf pattern with first, last and step index (e.g. 'slice%03d.raw 1 100 1')
+static void GetElementDataFiles(std::stringstream &linestream, std::ifstream &ifFile, std::string &filenameRaw, 
+                                std::vector<std::string> &filenamesRaw)
+  {
+  std::vector<std::string> items;
+  std::string item;
+  while (linestream >> item) items.push_back(item);
+  if (items.empty()) EchoExit(" ElementDataFile is empty");
+  filenameRaw = items[0];
+  if (items[0].compare("LIST") == 0)
+    {
+    std::string lineOfFile;
+    while (getline(ifFile, lineOfFile))
+      if (!TrimSpaces(lineOfFile).empty()) filenamesRaw.push_back(TrimSpaces(lineOfFile));
+    if (filenamesRaw.empty()) EchoExit(" ElementDataFile = LIST without files");
+    }
+  else if (items.size() == 4 && items[0].find('%') != std::string::npos)
+    {
+    const int first = stoi(items[1]), last = stoi(items[2]), step = stoi(items[3]);
+    if (step == 0) EchoExit(" ElementDataFile pattern needs a non-zero step");
+    for (int i = first; step > 0 ? i <= last : i >= last; i += step)
+      {
+      std::vector<char> filename(items[0].size() + 32);
+      snprintf(filename.data(), filename.size(), items[0].c_str(), i);
+      filenamesRaw.push_back(filename.data());
+      }
+    }
+  else if (items.size() != 1)
+    EchoExit(" ElementDataFile '" + linestream.str() + "' is not supported");
   }
 static elementTypes GetElementType(std::stringstream &linestream, std::string &item)
   {
@@ -154,7 +238,7 @@ static elementTypes GetElementType(std::stringstream &linestream, std::string &i
   else if (item.compare("MET_USHORT") == 0)         elementType = MET_USHORT;
   else if (item.compare("MET_LONG") == 0)           elementType = MET_LONG;
   else if (item.compare("MET_ULONG") == 0)          elementType = MET_ULONG;
-  else if (item.compare("MET_MET_LONG_LONG") == 0)  elementType = MET_LONG_LONG;
+  else if (item.compare("MET_LONG_LONG") == 0)      elementType = MET_LONG_LONG;
   else if (item.compare("MET_ULONG_LONG") == 0)     elementType = MET_ULONG_LONG;
   else if (item.compare("MET_FLOAT") == 0)          elementType = MET_FLOAT;
   else if (item.compare("MET_DOUBLE") == 0)         elementType = MET_DOUBLE;
@@ -171,6 +255,20 @@ struct mhdHdr3D
   doublexyz     voxelSize;
   std::string   modality; // "MET_MOD_CT", "MET_MOD_MR", "MET_MOD_NM", "MET_MOD_PET", "MET_MOD_SPECT",
                           // "MET_MOD_ATLAS", "MET_MOD_OTHER"
+  doublexyz     offset;                     // Offset (or Origin, Position): world position of the first voxel
+  std::array<double,9> transformMatrix = {{ 1, 0, 0, 0, 1, 0, 0, 0, 1 }}; // TransformMatrix (or Rotation, 
+                                            // Orientation): direction cosines, row by row
+  doublexyz     centerOfRotation;
+  std::string   anatomicalOrientation;      // e.g. "RAI" (empty if not given)
+  int64_t       headerSize         = 0;     // bytes skipped at the start of each data file (-1: data at the end)
+  bool          headerSizeGiven    = false; // HeaderSize is written/was read (also if 0): the data may then be a
+                                            // sub-range of a larger file
+  int           elementNumberOfChannels = 1;
+  std::vector<std::string> filenamesRaw;    // ElementDataFile = LIST (or pattern): data split into several files
+                                            // of equal numbers of z-slices (filenameRaw is then "LIST" etc.)
+  bool          byteOrderMSB       = false; // raw data are big-endian (swapped on reading; always written LSB)
+  bool          compressedData     = false; // raw file is a zlib stream (usually .zraw)
+  uint64_t      compressedDataSize = 0;     // bytes of the compressed raw file (0 if not given)
   };
 
 // type defined in MetaIO/src/metaTypes.h
@@ -186,33 +284,341 @@ template<> inline const char *GetElementTypeString<uint64_t>() { return "MET_ULO
 template<> inline const char *GetElementTypeString<float>()    { return "MET_FLOAT\n"; }
 template<> inline const char *GetElementTypeString<double>()   { return "MET_DOUBLE\n"; }
 
-template <typename T> void WriteMhdHeaderAndImage3D(const mhdHdr3D &hdr, rarray<T,3> image)
+// maps T onto the MET element type it is stored as on disk (MET_NONE if there is no exact match)
+template<typename T> inline constexpr elementTypes GetElementTypeOf() { return MET_NONE; }
+template<> inline constexpr elementTypes GetElementTypeOf<uint8_t>()  { return MET_UCHAR; }
+template<> inline constexpr elementTypes GetElementTypeOf<int16_t>()  { return MET_SHORT; }
+template<> inline constexpr elementTypes GetElementTypeOf<uint16_t>() { return MET_USHORT; }
+template<> inline constexpr elementTypes GetElementTypeOf<int32_t>()  { return MET_LONG; }
+template<> inline constexpr elementTypes GetElementTypeOf<uint32_t>() { return MET_ULONG; }
+template<> inline constexpr elementTypes GetElementTypeOf<int64_t>()  { return MET_LONG_LONG; }
+template<> inline constexpr elementTypes GetElementTypeOf<uint64_t>() { return MET_ULONG_LONG; }
+template<> inline constexpr elementTypes GetElementTypeOf<float>()    { return MET_FLOAT; }
+template<> inline constexpr elementTypes GetElementTypeOf<double>()   { return MET_DOUBLE; }
+
+// Compile-time dispatch on the element type of an image: a kernel is written once as a generic lambda and
+// instantiated for every supported MET type (fixed-width C++ types), e.g.
+//   VisitElementType(hdr.elementType, [&](auto tag) { typedef typename decltype(tag)::type T; Kernel<T>(hdr); });
+// Per-type fast paths are specializations (or if constexpr branches) of the kernel.
+template <typename T> struct ElementTypeTag { typedef T type; };
+typedef std::variant<ElementTypeTag<uint8_t>,  ElementTypeTag<int16_t>,  ElementTypeTag<uint16_t>,
+                     ElementTypeTag<int32_t>,  ElementTypeTag<uint32_t>, ElementTypeTag<int64_t>,
+                     ElementTypeTag<uint64_t>, ElementTypeTag<float>,    ElementTypeTag<double>> elementTypeVariant;
+
+static elementTypeVariant GetElementTypeVariant(elementTypes elementType)
+  {
+  switch (elementType)
+    {
+    case MET_UCHAR:      return ElementTypeTag<uint8_t>();
+    case MET_SHORT:      return ElementTypeTag<int16_t>();
+    case MET_USHORT:     return ElementTypeTag<uint16_t>();
+    case MET_LONG:       return ElementTypeTag<int32_t>();
+    case MET_ULONG:      return ElementTypeTag<uint32_t>();
+    case MET_LONG_LONG:  return ElementTypeTag<int64_t>();
+    case MET_ULONG_LONG: return ElementTypeTag<uint64_t>();
+    case MET_FLOAT:      return ElementTypeTag<float>();
+    case MET_DOUBLE:     return ElementTypeTag<double>();
+    default: EchoExit(std::string(" Element type '") + elementTypeNames[elementType] + "' not supported");
+    }
+  return ElementTypeTag<uint8_t>();
+  }
+
+// calls visitor(ElementTypeTag<T>()) with the C++ type T of elementType and returns its result
+template <typename F> decltype(auto) VisitElementType(elementTypes elementType, F &&visitor)
+  {
+  return std::visit(std::forward<F>(visitor), GetElementTypeVariant(elementType));
+  }
+
+// read-only memory mapping of a whole (raw data) file; pages are only loaded when they are touched
+// (or, if writable, a shared read-write mapping: changes go straight into the file)
+class MappedFile
+  {
+  public:
+    explicit MappedFile(const std::string &filename, bool writable = false)
+      {
+      const int fd = open(filename.c_str(), writable ? O_RDWR : O_RDONLY);
+      if (fd < 0) EchoExit(" Could not open file '" + filename + "' for mapping");
+      struct stat st;
+      if (fstat(fd, &st) != 0) { close(fd); EchoExit(" Could not stat file '" + filename + "'"); }
+      mappedSize = st.st_size;
+      if (mappedSize > 0)
+        {
+        mappedData = writable ? mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                              : mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mappedData == MAP_FAILED) { close(fd); EchoExit(" Could not map file '" + filename + "'"); }
+        }
+      close(fd); // the mapping keeps its own reference to the file
+      }
+    ~MappedFile() { if (mappedData != nullptr) munmap(mappedData, mappedSize); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator = (const MappedFile&) = delete;
+    const void *data() const { return mappedData; }
+    void       *writableData() { return mappedData; } // only if mapped writable
+    size_t      size() const { return mappedSize; }
+    void adviseSequential() const { if (mappedData != nullptr) madvise(mappedData, mappedSize, MADV_SEQUENTIAL); }
+  private:
+    void   *mappedData = nullptr;
+    size_t  mappedSize = 0;
+  };
+
+// Deflates data into one zlib stream that every inflate reads (ITK, Aliza, ...). The data are cut into chunks that
+// are deflated independently on all cores and joined with sync flush markers (as pigz does); the adler32 checksums
+// of the chunks are combined. compress() may be called repeatedly (e.g. per slab) before finish().
+class ParallelDeflater
+  {
+  public:
+    explicit ParallelDeflater(int level = Z_DEFAULT_COMPRESSION, size_t chunkBytes = 1 << 20)
+      : level(level), chunkBytes(chunkBytes) {}
+    // appends the compressed data to out (preceded by the zlib header on the first call)
+    void compress(const void *data, size_t bytes, std::vector<uint8_t> &out)
+      {
+      if (!started) WriteStreamHeader(out);
+      const size_t chunks = (bytes + chunkBytes - 1) / chunkBytes;
+      std::vector<std::vector<uint8_t>> deflated(chunks);
+      std::vector<uLong>                adlers(chunks);
+      ParallelFor(0, chunks, [&](size_t c)
+        {
+        const Bytef *in = static_cast<const Bytef*>(data) + c * chunkBytes;
+        const size_t n  = std::min(chunkBytes, bytes - c * chunkBytes);
+        DeflateChunk(in, n, deflated[c]);
+        adlers[c] = adler32(adler32(0L, Z_NULL, 0), in, n);
+        });
+      for (size_t c = 0; c < chunks; c++)
+        {
+        out.insert(out.end(), deflated[c].begin(), deflated[c].end());
+        adler = adler32_combine(adler, adlers[c], std::min(chunkBytes, bytes - c * chunkBytes));
+        }
+      }
+    // appends an empty final block and the adler32 trailer
+    void finish(std::vector<uint8_t> &out)
+      {
+      if (!started) WriteStreamHeader(out);
+      out.push_back(0x03); out.push_back(0x00); // final, fixed Huffman block holding only end-of-block
+      for (int i = 3; i >= 0; i--) out.push_back((adler >> (8 * i)) & 0xff);
+      }
+  private:
+    void WriteStreamHeader(std::vector<uint8_t> &out) 
+      { out.push_back(0x78); out.push_back(0x9c); started = true; } // deflate, 32K window
+    void DeflateChunk(const Bytef *in, size_t n, std::vector<uint8_t> &out) const
+      {
+      z_stream strm = {};
+      if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) EchoExit(" deflateInit2 failed");
+      out.resize(deflateBound(&strm, n) + 16); // + room for the sync flush marker
+      strm.next_in   = const_cast<Bytef*>(in);
+      strm.avail_in  = n;
+      strm.next_out  = out.data();
+      strm.avail_out = out.size();
+      if (deflate(&strm, Z_SYNC_FLUSH) != Z_OK || strm.avail_in != 0) EchoExit(" deflate failed");
+      out.resize(strm.total_out);
+      deflateEnd(&strm);
+      }
+    const int    level;
+    const size_t chunkBytes;
+    bool         started = false;
+    uLong        adler   = 1; // adler32 of no data
+  };
+
+// Inflates a zlib compressed (raw data) file sequentially into consecutive destination buffers.
+// A single zlib stream has no independent entry points, so inflating is inherently serial; slab readers overlap
+// it with processing instead.
+class ZlibInflater
+  {
+  public:
+    // the zlib stream starts offset bytes into the file
+    explicit ZlibInflater(const std::string &filename, uint64_t offset = 0)
+      : filename(filename), compressed(filename), consumed(offset)
+      {
+      if (offset > compressed.size()) EchoExit(" HeaderSize is beyond the end of '" + filename + "'");
+      compressed.adviseSequential();
+      if (inflateInit(&strm) != Z_OK) EchoExit(" inflateInit failed for '" + filename + "'");
+      }
+    ~ZlibInflater() { inflateEnd(&strm); }
+    ZlibInflater(const ZlibInflater&) = delete;
+    ZlibInflater& operator = (const ZlibInflater&) = delete;
+    // fills exactly bytes into dst
+    void inflateInto(void *dst, size_t bytes)
+      {
+      Bytef *out = static_cast<Bytef*>(dst);
+      while (bytes > 0)
+        {
+        if (strm.avail_in == 0 && consumed < compressed.size())
+          {
+          const size_t n = std::min<size_t>(compressed.size() - consumed, 1 << 30); // avail_in is 32 bit
+          strm.next_in   = const_cast<Bytef*>(static_cast<const Bytef*>(compressed.data()) + consumed);
+          strm.avail_in  = n;
+          consumed      += n;
+          }
+        const size_t n = std::min<size_t>(bytes, 1 << 30);
+        strm.next_out  = out;
+        strm.avail_out = n;
+        const int ret = inflate(&strm, Z_NO_FLUSH);
+        const size_t produced = n - strm.avail_out;
+        out   += produced;
+        bytes -= produced;
+        if (ret == Z_STREAM_END && bytes > 0) EchoExit(" Compressed data in '" + filename + "' end too early");
+        if (ret == Z_STREAM_END) break;
+        if (ret != Z_OK && !(ret == Z_BUF_ERROR && produced > 0))
+          EchoExit(" Compressed data in '" + filename + "' are corrupt or truncated");
+        }
+      }
+  private:
+    const std::string filename;
+    MappedFile        compressed;
+    z_stream          strm     = {};
+    size_t            consumed = 0;
+  };
+
+// number of voxels of a 3D image, computed in 64 bit; exits on non-positive dimensions or overflow
+static uint64_t GetNumberOfVoxels3D(intxyz voxels)
+  {
+  if (voxels.x <= 0 || voxels.y <= 0 || voxels.z <= 0)
+    EchoExit(" Invalid image dimensions " + std::to_string(voxels.x) + " x " + std::to_string(voxels.y) + " x " +
+             std::to_string(voxels.z));
+  uint64_t n;
+  if (__builtin_mul_overflow((uint64_t)voxels.x * (uint64_t)voxels.y, (uint64_t)voxels.z, &n)) // x*y < 2^62
+    EchoExit(" Number of voxels exceeds 64 bit");
+  return n;
+  }
+
+// number of bytes of the uncompressed raw data of a 3D image with elements of elementBytes
+static uint64_t GetNumberOfBytes3D(intxyz voxels, size_t elementBytes)
+  {
+  uint64_t bytes;
+  if (__builtin_mul_overflow(GetNumberOfVoxels3D(voxels), (uint64_t)elementBytes, &bytes) || 
+      bytes > (uint64_t)std::numeric_limits<std::streamsize>::max())
+    EchoExit(" Image size exceeds the 64 bit file size range");
+  return bytes;
+  }
+
+// Stream I/O in chunks of at most 1 GiB: a single huge read()/write() is split up by the kernel anyway, and
+// some stream implementations handle counts beyond 2^31 poorly. Exits with the file name on failure.
+static const uint64_t rawIoChunkBytes = uint64_t(1) << 30;
+
+static void WriteRawBytes(std::ofstream &ofFile, const void *data, uint64_t bytes, const std::string &filename)
+  {
+  const char *p = static_cast<const char*>(data);
+  for (uint64_t done = 0; done < bytes; )
+    {
+    const uint64_t n = std::min(bytes - done, rawIoChunkBytes);
+    ofFile.write(p + done, (std::streamsize)n);
+    if (!ofFile) EchoExit("Could not write raw file '" + filename + "' (" + std::to_string(done) + " of " + 
+                          std::to_string(bytes) + " bytes written)");
+    done += n;
+    }
+  }
+
+static void ReadRawBytes(std::ifstream &ifFile, void *data, uint64_t bytes, const std::string &filename)
+  {
+  char *p = static_cast<char*>(data);
+  for (uint64_t done = 0; done < bytes; )
+    {
+    const uint64_t n = std::min(bytes - done, rawIoChunkBytes);
+    ifFile.read(p + done, (std::streamsize)n);
+    if (!ifFile) EchoExit(" Could not read data file '" + filename + "' (" + std::to_string(done) + " of " + 
+                          std::to_string(bytes) + " bytes read)");
+    done += n;
+    }
+  }
+
+// writes the raw data file (zlib compressed if requested) and returns its size in bytes
+static uint64_t WriteMhdRawData3D(const std::string &filenameRaw, const void *data, uint64_t bytes, bool compress)
+  {
+  std::ofstream ofFile;
+  ofFile.open(filenameRaw, std::ios::binary);
+  if (!ofFile) EchoExit("Could not open raw file '" + filenameRaw + "' for writing");
+  if (compress)
+    {
+    std::vector<uint8_t> compressed;
+    ParallelDeflater deflater;
+    deflater.compress(data, bytes, compressed);
+    deflater.finish(compressed);
+    WriteRawBytes(ofFile, compressed.data(), compressed.size(), filenameRaw);
+    }
+  else
+    WriteRawBytes(ofFile, data, bytes, filenameRaw);
+  const uint64_t fileBytes = ofFile.tellp();
+  ofFile.close();
+  if (ofFile.fail()) EchoExit("Could not close raw file '" + filenameRaw + "'");
+  return fileBytes;
+  }
+
+// Writes the MetaImage header of hdr; the raw data are written separately. Optional keys (Offset, TransformMatrix,
+// CenterOfRotation, AnatomicalOrientation, ElementNumberOfChannels, HeaderSize) are only written if they differ 
+// from their defaults (HeaderSize also if it is given), so headers read by ReadMhdHeader3D round-trip.
+static void WriteMhdHeader3D(const mhdHdr3D &hdr, uint64_t compressedDataSize = 0)
   {
-  // write header
   std::ofstream ofFile;
   ofFile.open(hdr.filenameMhd);
   if (!ofFile) EchoExit("Could not open raw file '" + hdr.filenameMhd + "' for writing");
   ofFile << "ObjectType = Image\n";
   ofFile << "BinaryData = True\n";
-  ofFile << "BinaryDataByteOrderMSB = False\n";
-  ofFile << "CompressedData = False\n";
+  ofFile << "BinaryDataByteOrderMSB = " << (hdr.byteOrderMSB ? "True" : "False") << "\n";
+  if (hdr.compressedData)
+    {
+    ofFile << "CompressedData = True\n";
+    ofFile << "CompressedDataSize = " << compressedDataSize << "\n";
+    }
+  else
+    ofFile << "CompressedData = False\n";
   ofFile << "Modality = " << hdr.modality << "\n";
   ofFile << "NDims = 3\n";
+  if (hdr.offset.x != 0 || hdr.offset.y != 0 || hdr.offset.z != 0)
+    ofFile << "Offset = " << hdr.offset.x << " " << hdr.offset.y << " " << hdr.offset.z << "\n";
+  if (hdr.transformMatrix != mhdHdr3D().transformMatrix)
+    {
+    ofFile << "TransformMatrix =";
+    for (double value : hdr.transformMatrix) ofFile << " " << value;
+    ofFile << "\n";
+    }
+  if (hdr.centerOfRotation.x != 0 || hdr.centerOfRotation.y != 0 || hdr.centerOfRotation.z != 0)
+    ofFile << "CenterOfRotation = " << hdr.centerOfRotation.x << " " << hdr.centerOfRotation.y << " " 
+           << hdr.centerOfRotation.z << "\n";
+  if (!hdr.anatomicalOrientation.empty())
+    ofFile << "AnatomicalOrientation = " << hdr.anatomicalOrientation << "\n";
   ofFile << "DimSize = " << hdr.voxels.x << " " << hdr.voxels.y << " " << hdr.voxels.z << "\n";
-  ofFile << "ElementType = " << GetElementTypeString<T>();
+  ofFile << "ElementType = " << elementTypeNames[hdr.elementType] << "\n";
+  if (hdr.elementNumberOfChannels != 1)
+    ofFile << "ElementNumberOfChannels = " << hdr.elementNumberOfChannels << "\n";
   ofFile << "ElementSize = " << hdr.voxelSize.x << " " << hdr.voxelSize.y << " " << hdr.voxelSize.z << "\n";
   ofFile << "ElementSpacing = " << hdr.voxelSize.x << " " << hdr.voxelSize.y << " " << hdr.voxelSize.z << "\n";
-  ofFile << "ElementDataFile = " << hdr.filenameRaw << "\n";
+  if (hdr.headerSize != 0 || hdr.headerSizeGiven)
+    ofFile << "HeaderSize = " << hdr.headerSize << "\n";
+  if (hdr.filenamesRaw.empty())
+    ofFile << "ElementDataFile = " << hdr.filenameRaw << "\n";
+  else
+    {
+    ofFile << "ElementDataFile = LIST\n";
+    for (const std::string &filename : hdr.filenamesRaw) ofFile << filename << "\n";
+    }
   ofFile.close();
-  // write data
-  ofFile.open(hdr.filenameRaw, std::ios::binary);
-  if (!ofFile) 
-    EchoExit("Could not raw open file '" + hdr.filenameRaw + "' for writing");
-  const uint32_t numberOfBytes = sizeof(T) * hdr.voxels.x * hdr.voxels.y * hdr.voxels.z;
-  ofFile.write(reinterpret_cast<char*>(image.data()), image.size() * sizeof(T));
-  if (ofFile.tellp() != numberOfBytes)
+  if (ofFile.fail()) EchoExit("Could not write file '" + hdr.filenameMhd + "'");
+  }
+
+// header of the data written by the writers below: a single little-endian raw file of T without header bytes
+template <typename T> mhdHdr3D GetWrittenMhdHdr3D(const mhdHdr3D &hdr)
+  {
+  GetElementTypeString<T>(); // exits for types without MET element type
+  mhdHdr3D writtenHdr = hdr;
+  writtenHdr.elementType             = GetElementTypeOf<T>();
+  writtenHdr.byteOrderMSB            = false;
+  writtenHdr.headerSize              = 0;
+  writtenHdr.headerSizeGiven         = false;
+  writtenHdr.elementNumberOfChannels = 1;
+  writtenHdr.filenamesRaw.clear();
+  return writtenHdr;
+  }
+
+template <typename T> void WriteMhdHeaderAndImage3D(const mhdHdr3D &hdr, rarray<T,3> image)
+  {
+  // write data (the header needs the size of compressed data)
+  const uint64_t numberOfBytes = GetNumberOfBytes3D(hdr.voxels, sizeof(T));
+  if ((uint64_t)image.size() * sizeof(T) != numberOfBytes)
+    EchoExit("Size of rarray does not match header number of voxels of '" + hdr.filenameMhd + "'");
+  const uint64_t fileBytes = WriteMhdRawData3D(hdr.filenameRaw, image.data(), numberOfBytes, hdr.compressedData);
+  if (!hdr.compressedData && fileBytes != numberOfBytes)
     EchoExit("Number of bytes written does not match header number of voxels");
-  ofFile.close();
+  // write header
+  WriteMhdHeader3D(GetWrittenMhdHdr3D<T>(hdr), fileBytes);
   }
 
 static mhdHdr3D ReadMhdHeader3D(const std::string &filenameMhd)
@@ -226,44 +632,45 @@ static mhdHdr3D ReadMhdHeader3D(const std::string &filenameMhd)
   std::string lineOfFile;
   while(getline(ifFile, lineOfFile)) 
     {
-    std::stringstream linestream(lineOfFile);
+    const size_t equal = lineOfFile.find('=');
+    if (equal == std::string::npos) continue;
+    const std::string key = TrimSpaces(lineOfFile.substr(0, equal));
+    std::stringstream linestream(TrimSpaces(lineOfFile.substr(equal + 1)));
     std::string item;
-    getline(linestream, item, ' ');
       {
-      if      (item.compare("ObjectType") == 0)             CheckObjectType(linestream, item);
-      else if (item.compare("BinaryData") == 0)             CheckBinaryData(linestream, item);
-      else if (item.compare("BinaryDataByteOrderMSB") == 0) CheckBinaryDataByteOrderMSB(linestream, item);
-      else if (item.compare("CompressedData") == 0)         CheckCompressedData(linestream, item);
-      else if (item.compare("Modality") == 0)
-        {
-        getline(linestream, item, ' '); // '='
-        getline(linestream, item, ' '); hdr.modality = item;
-        }
-      else if (item.compare("NDims") == 0)                  CheckNdims(linestream, item, 3);
-      else if (item.compare("ElementDataFile") == 0)      hdr.filenameRaw = GetElementDataFile(linestream, item);
-      else if (item.compare("ElementType") == 0)            hdr.elementType = GetElementType(linestream, item);
-      else if (item.compare("DimSize") == 0)
+      if      (key.compare("ObjectType") == 0)             CheckObjectType(linestream, item);
+      else if (key.compare("BinaryData") == 0)             CheckBinaryData(linestream, item);
+      else if (key.compare("BinaryDataByteOrderMSB") == 0 || key.compare("ElementByteOrderMSB") == 0)
+        hdr.byteOrderMSB = GetBinaryDataByteOrderMSB(linestream, item);
+      else if (key.compare("CompressedData") == 0)         hdr.compressedData = GetCompressedData(linestream, item);
+      else if (key.compare("CompressedDataSize") == 0)     { linestream >> item; hdr.compressedDataSize = stoull(item); }
+      else if (key.compare("Modality") == 0)               linestream >> hdr.modality;
+      else if (key.compare("NDims") == 0)                  CheckNdims(linestream, item, 3);
+      else if (key.compare("ElementType") == 0)            hdr.elementType = GetElementType(linestream, item);
+      else if (key.compare("DimSize") == 0)
         {
-        getline(linestream, item, ' '); // '='
-        getline(linestream, item, ' '); hdr.voxels.x = stoi(item);
-        getline(linestream, item, ' '); hdr.voxels.y = stoi(item);
-        getline(linestream, item, ' '); hdr.voxels.z = stoi(item);
+        double dimSize[3];
+        GetValues(linestream, key, dimSize, 3);
+        hdr.voxels = intxyz((int)dimSize[0], (int)dimSize[1], (int)dimSize[2]);
         }
-      else if (item.compare("ElementSize") == 0)
+      else if (key.compare("ElementSize") == 0 || key.compare("ElementSpacing") == 0)
+        GetValues(linestream, key, &hdr.voxelSize.x, 3);
+      else if (key.compare("Offset") == 0 || key.compare("Origin") == 0 || key.compare("Position") == 0)
+        GetValues(linestream, key, &hdr.offset.x, 3);
+      else if (key.compare("TransformMatrix") == 0 || key.compare("Rotation") == 0 || 
+               key.compare("Orientation") == 0)
+        GetValues(linestream, key, hdr.transformMatrix.data(), 9);
+      else if (key.compare("CenterOfRotation") == 0)       GetValues(linestream, key, &hdr.centerOfRotation.x, 3);
+      else if (key.compare("AnatomicalOrientation") == 0)  linestream >> hdr.anatomicalOrientation;
+      else if (key.compare("HeaderSize") == 0)             { linestream >> item; hdr.headerSize = stoll(item); 
+                                                             hdr.headerSizeGiven = true; }
+      else if (key.compare("ElementNumberOfChannels") == 0){ linestream >> item; hdr.elementNumberOfChannels = stoi(item);}
+      else if (key.compare("ElementDataFile") == 0)        // always the last key
         {
-        getline(linestream, item, ' '); // '='
-        getline(linestream, item, ' '); hdr.voxelSize.x = stod(item);
-        getline(linestream, item, ' '); hdr.voxelSize.y = stod(item);
-        getline(linestream, item, ' '); hdr.voxelSize.z = stod(item);
+        GetElementDataFiles(linestream, ifFile, hdr.filenameRaw, hdr.filenamesRaw);
+        break;
         }
-      else if (item.compare("ElementSpacing") == 0)
-        {
-        getline(linestream, item, ' '); // '='
-        getline(linestream, item, ' '); hdr.voxelSize.x = stod(item);
-        getline(linestream, item, ' '); hdr.voxelSize.y = stod(item);
-        getline(linestream, item, ' '); hdr.voxelSize.z = stod(item);
-        }
-      //else ECHO_WARNING("%s is not handled (yet)", item.c_str());
+      //else ECHO_WARNING("%s is not handled (yet)", key.c_str());
       }
     }
   if (ifFile.bad()) EchoExit(" Error while reading file");
@@ -271,55 +678,1458 @@ static mhdHdr3D ReadMhdHeader3D(const std::string &filenameMhd)
   return hdr;
   }
 
-#define READ_3DIMAGE(TYPE) \
-  { \
-  rarray<TYPE,1> tempImage((*image).size()); \
-  ifFile.read(reinterpret_cast<char*>(tempImage.data()), (*image).size() * sizeof(T)); \
-  u_int64_t i = 0; \
-  for (int z = 0; z < hdr.voxels.z; z++) \
-    for (int y = 0; y < hdr.voxels.y; y++) \
-      for (int x = 0; x < hdr.voxels.x; x++) \
-        (*image)[z][y][x] = static_cast<T>(tempImage[i++]); \
-  tempImage.clear(); \
+// all lines of a MetaImage header in file order: "Key = Value" lines as { key, value } with the value keeping its
+// original text, all other lines (comments and the file list after ElementDataFile = LIST) verbatim as { "", line }
+typedef std::vector<std::pair<std::string, std::string>> mhdKeyValues;
+
+static mhdKeyValues ReadMhdKeyValues(const std::string &filenameMhd)
+  {
+  std::ifstream ifFile;
+  ifFile.open(filenameMhd);
+  if (!ifFile.is_open()) EchoExit(" Could not open file '" + filenameMhd + "' for reading");
+  mhdKeyValues keyValues;
+  std::string lineOfFile;
+  bool afterDataFile = false; // ElementDataFile is the last key, what follows it belongs to it
+  while (getline(ifFile, lineOfFile))
+    {
+    const size_t equal = lineOfFile.find('=');
+    if (afterDataFile || equal == std::string::npos || TrimSpaces(lineOfFile.substr(0, equal)).empty())
+      {
+      keyValues.push_back({ "", lineOfFile });
+      continue;
+      }
+    keyValues.push_back({ TrimSpaces(lineOfFile.substr(0, equal)), TrimSpaces(lineOfFile.substr(equal + 1)) });
+    afterDataFile = keyValues.back().first == "ElementDataFile";
+    }
+  if (ifFile.bad()) EchoExit(" Error while reading file '" + filenameMhd + "'");
+  return keyValues;
   }
 
-template <typename T> void ReadMhdImage3D(const mhdHdr3D &hdr, rarray<T,3> *image)
+// Writes a MetaImage header atomically: the lines go into a temporary file in the same directory, which then
+// replaces the header with rename(), so readers see either the old or the new header, never a partial one.
+static void WriteMhdKeyValues(const std::string &filenameMhd, const mhdKeyValues &keyValues)
   {
-  // check data file
-  if (!std::filesystem::exists(hdr.filenameRaw)) EchoExit(" Data file '" + hdr.filenameRaw + "' does not exist");
-  if (std::filesystem::file_size(hdr.filenameRaw) != (*image).size() * elementTypeSize[hdr.elementType])
-    EchoExit(" File size of '" + hdr.filenameRaw + " does not fit Mhd image size");
+  const std::string filenameTmp = filenameMhd + ".tmp" + std::to_string(getpid());
+  std::ofstream ofFile;
+  ofFile.open(filenameTmp);
+  if (!ofFile) EchoExit("Could not open file '" + filenameTmp + "' for writing");
+  for (const auto &keyValue : keyValues)
+    if (keyValue.first.empty()) ofFile << keyValue.second << "\n";
+    else                        ofFile << keyValue.first << " = " << keyValue.second << "\n";
+  ofFile.close();
+  if (ofFile.fail() || rename(filenameTmp.c_str(), filenameMhd.c_str()) != 0)
+    {
+    remove(filenameTmp.c_str());
+    EchoExit("Could not write file '" + filenameMhd + "'");
+    }
+  }
+
+// Byte order reversal of n elements of BYTES (2, 4 or 8) bytes each from src into dst (which may be src). The
+// SSSE3/AVX2 versions reverse 16/32 bytes per shuffle; they are compiled with target attributes and chosen at run
+// time, so the binary still runs on CPUs without them.
+template <size_t BYTES> void SwapBytesScalar(const uint8_t *src, uint8_t *dst, size_t n)
+  {
+  for (size_t i = 0; i < n; i++, src += BYTES, dst += BYTES)
+    {
+    if constexpr (BYTES == 2) { uint16_t e; memcpy(&e, src, 2); e = __builtin_bswap16(e); memcpy(dst, &e, 2); }
+    if constexpr (BYTES == 4) { uint32_t e; memcpy(&e, src, 4); e = __builtin_bswap32(e); memcpy(dst, &e, 4); }
+    if constexpr (BYTES == 8) { uint64_t e; memcpy(&e, src, 8); e = __builtin_bswap64(e); memcpy(dst, &e, 8); }
+    }
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+template <size_t BYTES> __attribute__((target("ssse3"))) void SwapBytesSSSE3(const uint8_t *src, uint8_t *dst, 
+                                                                             size_t n)
+  {
+  alignas(16) uint8_t order[16];
+  for (size_t b = 0; b < 16; b++)
+    order[b] = (b / BYTES) * BYTES + BYTES - 1 - b % BYTES;
+  const __m128i shuffle = _mm_load_si128(reinterpret_cast<const __m128i*>(order));
+  const size_t perVector = 16 / BYTES;
+  size_t i = 0;
+  for (; i + perVector <= n; i += perVector)
+    {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * BYTES));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * BYTES), _mm_shuffle_epi8(v, shuffle));
+    }
+  SwapBytesScalar<BYTES>(src + i * BYTES, dst + i * BYTES, n - i);
+  }
+
+template <size_t BYTES> __attribute__((target("avx2"))) void SwapBytesAVX2(const uint8_t *src, uint8_t *dst, size_t n)
+  {
+  alignas(32) uint8_t order[32]; // vpshufb shuffles within each 128 bit lane
+  for (size_t b = 0; b < 32; b++)
+    order[b] = (b % 16 / BYTES) * BYTES + BYTES - 1 - b % BYTES;
+  const __m256i shuffle = _mm256_load_si256(reinterpret_cast<const __m256i*>(order));
+  const size_t perVector = 32 / BYTES;
+  size_t i = 0;
+  for (; i + perVector <= n; i += perVector)
+    {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * BYTES));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * BYTES), _mm256_shuffle_epi8(v, shuffle));
+    }
+  SwapBytesScalar<BYTES>(src + i * BYTES, dst + i * BYTES, n - i);
+  }
+#endif
+
+template <size_t BYTES> void SwapBytes(const void *src, void *dst, size_t n)
+  {
+  const uint8_t *s = static_cast<const uint8_t*>(src);
+  uint8_t       *d = static_cast<uint8_t*>(dst);
+#if defined(__x86_64__) || defined(__i386__)
+  static const bool avx2  = __builtin_cpu_supports("avx2");
+  static const bool ssse3 = __builtin_cpu_supports("ssse3");
+  if      (avx2)  SwapBytesAVX2<BYTES>(s, d, n);
+  else if (ssse3) SwapBytesSSSE3<BYTES>(s, d, n);
+  else            SwapBytesScalar<BYTES>(s, d, n);
+#else
+  SwapBytesScalar<BYTES>(s, d, n);
+#endif
+  }
+
+// Reverses the order of n elements of BYTES (1, 2, 4 or 8) bytes each in place (a row mirrored along x). The
+// SSSE3/AVX2 versions load 16/32 bytes from both ends, reverse the elements within each vector with one shuffle 
+// (and a lane swap for AVX2) and store them crosswise; like SwapBytes they are chosen at run time.
+template <size_t BYTES> void ReverseElementsScalar(uint8_t *data, size_t n)
+  {
+  typedef typename std::conditional<BYTES == 1, uint8_t, typename std::conditional<BYTES == 2, uint16_t,
+          typename std::conditional<BYTES == 4, uint32_t, uint64_t>::type>::type>::type element;
+  for (size_t i = 0, j = n - 1; i < n / 2; i++, j--)
+    {
+    element a, b;
+    memcpy(&a, data + i * BYTES, BYTES);
+    memcpy(&b, data + j * BYTES, BYTES);
+    memcpy(data + i * BYTES, &b, BYTES);
+    memcpy(data + j * BYTES, &a, BYTES);
+    }
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+template <size_t BYTES> __attribute__((target("ssse3"))) void ReverseElementsSSSE3(uint8_t *data, size_t n)
+  {
+  alignas(16) uint8_t order[16];
+  for (size_t b = 0; b < 16; b++)
+    order[b] = (16 / BYTES - 1 - b / BYTES) * BYTES + b % BYTES;
+  const __m128i shuffle = _mm_load_si128(reinterpret_cast<const __m128i*>(order));
+  const size_t perVector = 16 / BYTES;
+  size_t lo = 0, hi = n;
+  for (; hi - lo >= 2 * perVector; lo += perVector, hi -= perVector)
+    {
+    __m128i *front = reinterpret_cast<__m128i*>(data + lo * BYTES);
+    __m128i *back  = reinterpret_cast<__m128i*>(data + (hi - perVector) * BYTES);
+    const __m128i f = _mm_loadu_si128(front), b = _mm_loadu_si128(back);
+    _mm_storeu_si128(front, _mm_shuffle_epi8(b, shuffle));
+    _mm_storeu_si128(back,  _mm_shuffle_epi8(f, shuffle));
+    }
+  ReverseElementsScalar<BYTES>(data + lo * BYTES, hi - lo);
+  }
+
+template <size_t BYTES> __attribute__((target("avx2"))) void ReverseElementsAVX2(uint8_t *data, size_t n)
+  {
+  alignas(32) uint8_t order[32]; // vpshufb reverses within each 128 bit lane, vpermq swaps the lanes
+  for (size_t b = 0; b < 32; b++)
+    order[b] = (16 / BYTES - 1 - b % 16 / BYTES) * BYTES + b % BYTES;
+  const __m256i shuffle = _mm256_load_si256(reinterpret_cast<const __m256i*>(order));
+  const size_t perVector = 32 / BYTES;
+  size_t lo = 0, hi = n;
+  for (; hi - lo >= 2 * perVector; lo += perVector, hi -= perVector)
+    {
+    __m256i *front = reinterpret_cast<__m256i*>(data + lo * BYTES);
+    __m256i *back  = reinterpret_cast<__m256i*>(data + (hi - perVector) * BYTES);
+    const __m256i f = _mm256_loadu_si256(front), b = _mm256_loadu_si256(back);
+    _mm256_storeu_si256(front, _mm256_permute4x64_epi64(_mm256_shuffle_epi8(b, shuffle), 0x4E));
+    _mm256_storeu_si256(back,  _mm256_permute4x64_epi64(_mm256_shuffle_epi8(f, shuffle), 0x4E));
+    }
+  ReverseElementsSSSE3<BYTES>(data + lo * BYTES, hi - lo);
+  }
+#endif
+
+template <size_t BYTES> void ReverseElements(void *data, size_t n)
+  {
+  uint8_t *d = static_cast<uint8_t*>(data);
+  if (n < 2) return;
+#if defined(__x86_64__) || defined(__i386__)
+  static const bool avx2  = __builtin_cpu_supports("avx2");
+  static const bool ssse3 = __builtin_cpu_supports("ssse3");
+  if      (avx2)  ReverseElementsAVX2<BYTES>(d, n);
+  else if (ssse3) ReverseElementsSSSE3<BYTES>(d, n);
+  else            ReverseElementsScalar<BYTES>(d, n);
+#else
+  ReverseElementsScalar<BYTES>(d, n);
+#endif
+  }
+
+// converts n elements of TIN into T; with swapBytes the input is big-endian. Swapping is fused into the copy: blocks
+// of the input are swapped into a small buffer that stays in L1 cache and converted from there, so there is no
+// extra pass over memory.
+template <typename TIN, typename T> void ConvertElements(const void *src, T *dst, size_t n, bool swapBytes = false)
+  {
+  const TIN *in = static_cast<const TIN*>(src);
+  if (!swapBytes || sizeof(TIN) == 1)
+    {
+    for (size_t i = 0; i < n; i++)
+      dst[i] = static_cast<T>(in[i]);
+    }
+  else if (std::is_same<TIN, T>::value)
+    SwapBytes<sizeof(TIN)>(in, dst, n);
+  else
+    {
+    const size_t blockElements = 2048;
+    TIN block[blockElements];
+    for (size_t i0 = 0; i0 < n; i0 += blockElements)
+      {
+      const size_t m = std::min(blockElements, n - i0);
+      SwapBytes<sizeof(TIN)>(in + i0, block, m);
+      for (size_t i = 0; i < m; i++)
+        dst[i0 + i] = static_cast<T>(block[i]);
+      }
+    }
+  }
+
+// converts n raw elements of type elementType (big-endian if swapBytes) into T
+template <typename T> void ConvertRawElements(const void *src, elementTypes elementType, T *dst, size_t n,
+                                              bool swapBytes = false)
+  {
+  VisitElementType(elementType, [&](auto tag) 
+    { ConvertElements<typename decltype(tag)::type>(src, dst, n, swapBytes); });
+  }
+
+// true if the raw data have to be byte swapped on reading
+static bool NeedsByteSwap(const mhdHdr3D &hdr) { return hdr.byteOrderMSB && elementTypeSize[hdr.elementType] > 1; }
+
+// true if the raw data can be used as T directly (same type, same byte order)
+template <typename T> bool IsNativeRawData(const mhdHdr3D &hdr)
+  {
+  return hdr.elementType == GetElementTypeOf<T>() && !NeedsByteSwap(hdr);
+  }
+
+// the raw data files of a header: one file, or one per group of z-slices for ElementDataFile = LIST
+static std::vector<std::string> GetMhdRawFilenames(const mhdHdr3D &hdr)
+  {
+  return hdr.filenamesRaw.empty() ? std::vector<std::string>{ hdr.filenameRaw } : hdr.filenamesRaw;
+  }
+
+// number of (uncompressed) data bytes in each raw data file
+static uint64_t GetMhdBytesPerRawFile(const mhdHdr3D &hdr)
+  {
+  const size_t files = GetMhdRawFilenames(hdr).size();
+  if (hdr.voxels.z % files != 0)
+    EchoExit(" DimSize z of '" + hdr.filenameMhd + "' is not a multiple of the number of data files");
+  return GetNumberOfBytes3D(hdr.voxels, elementTypeSize[hdr.elementType]) / files;
+  }
+
+// byte position of the data in a raw data file (HeaderSize = -1: the data are at the end of the file)
+static uint64_t GetMhdRawDataOffset(const mhdHdr3D &hdr, const std::string &filenameRaw)
+  {
+  if (hdr.headerSize >= 0) return hdr.headerSize;
+  if (hdr.compressedData) EchoExit(" HeaderSize = -1 is not supported for compressed data");
+  const uint64_t fileBytes = std::filesystem::file_size(filenameRaw), dataBytes = GetMhdBytesPerRawFile(hdr);
+  if (fileBytes < dataBytes) EchoExit(" File size of '" + filenameRaw + " does not fit Mhd image size");
+  return fileBytes - dataBytes;
+  }
+
+template <typename T> void CheckMhdImageDataFile3D(const mhdHdr3D &hdr)
+  {
+  if (hdr.elementNumberOfChannels != 1)
+    EchoExit(" ElementNumberOfChannels of '" + hdr.filenameMhd + "' is not 1 (only scalar images are supported)");
+  const uint64_t numberOfBytes = GetMhdBytesPerRawFile(hdr);
+  for (const std::string &filenameRaw : GetMhdRawFilenames(hdr))
+    {
+    if (!std::filesystem::exists(filenameRaw)) EchoExit(" Data file '" + filenameRaw + "' does not exist");
+    const uint64_t fileBytes = std::filesystem::file_size(filenameRaw), offset = GetMhdRawDataOffset(hdr, filenameRaw);
+    if (hdr.compressedData)
+      {
+      if (hdr.compressedDataSize > 0 && hdr.filenamesRaw.empty() && fileBytes != offset + hdr.compressedDataSize)
+        EchoExit(" File size of '" + filenameRaw + " does not fit CompressedDataSize");
+      }
+    // the data may be a sub-range of a larger file if HeaderSize is given
+    else if (hdr.headerSizeGiven || hdr.headerSize != 0 ? fileBytes < offset + numberOfBytes 
+                                                         : fileBytes != numberOfBytes)
+      EchoExit(" File size of '" + filenameRaw + " does not fit Mhd image size");
+    }
   if (elementTypeSize[hdr.elementType] > sizeof(T))
     EchoExit(" Data type size of raw data file '" + hdr.filenameRaw + "' is larger than rarray type");
-  // read data file (data type can be any of elementTypes as long as it can be converted into rarray type)
-  std::ifstream ifFile;
-  ifFile.open(hdr.filenameRaw, std::ios::binary);
-  if (!ifFile.is_open()) EchoExit(" Could not open file '" + hdr.filenameRaw + "' for reading");
-  switch (hdr.elementType)
-    {
-    case MET_UCHAR:      READ_3DIMAGE(uint8_t); break;
-    case MET_SHORT:      READ_3DIMAGE(int16_t); break;
-    case MET_USHORT:     READ_3DIMAGE(uint16_t); break;
-    case MET_LONG:       READ_3DIMAGE(int32_t); break;
-    case MET_ULONG:      READ_3DIMAGE(uint32_t); break;
-    case MET_LONG_LONG:  READ_3DIMAGE(int64_t); break;
-    case MET_ULONG_LONG: READ_3DIMAGE(uint64_t); break;
-    case MET_FLOAT:      READ_3DIMAGE(float); break;
-    case MET_DOUBLE:     READ_3DIMAGE(double); break;
-    default: EchoExit(" Element type of file '" + hdr.filenameRaw + "' not supported for reading");
+  }
+
+// Reads the raw data bytes of a mhd image sequentially, whatever their layout on disk: one file or a LIST of
+// files, each with HeaderSize bytes skipped, plain or zlib compressed.
+class MhdRawReader
+  {
+  public:
+    explicit MhdRawReader(const mhdHdr3D &hdr) 
+      : hdr(hdr), filenames(GetMhdRawFilenames(hdr)), bytesPerFile(GetMhdBytesPerRawFile(hdr)) {}
+    MhdRawReader(const MhdRawReader&) = delete;
+    MhdRawReader& operator = (const MhdRawReader&) = delete;
+    void read(void *dst, uint64_t bytes)
+      {
+      uint8_t *out = static_cast<uint8_t*>(dst);
+      while (bytes > 0)
+        {
+        if (bytesLeftInFile == 0) OpenNextFile();
+        const uint64_t n = std::min(bytes, bytesLeftInFile);
+        if (inflater)
+          inflater->inflateInto(out, n);
+        else
+          ReadRawBytes(ifFile, out, n, filenames[nextFile - 1]);
+        out             += n;
+        bytes           -= n;
+        bytesLeftInFile -= n;
+        }
+      }
+  private:
+    void OpenNextFile()
+      {
+      if (nextFile == filenames.size()) EchoExit(" Read beyond the image data of '" + hdr.filenameMhd + "'");
+      const std::string &filename = filenames[nextFile++];
+      const uint64_t offset = GetMhdRawDataOffset(hdr, filename);
+      if (hdr.compressedData)
+        inflater.reset(new ZlibInflater(filename, offset));
+      else
+        {
+        if (ifFile.is_open()) ifFile.close();
+        ifFile.open(filename, std::ios::binary);
+        if (!ifFile.is_open()) EchoExit(" Could not open file '" + filename + "' for reading");
+        ifFile.seekg(offset);
+        }
+      bytesLeftInFile = bytesPerFile;
+      }
+    const mhdHdr3D                 hdr;
+    const std::vector<std::string> filenames;
+    const uint64_t                 bytesPerFile;
+    size_t                         nextFile        = 0;
+    uint64_t                       bytesLeftInFile = 0;
+    std::ifstream                  ifFile;
+    std::unique_ptr<ZlibInflater>  inflater; // if the data are compressed
+  };
+
+template <typename T> void ReadMhdImage3D(const mhdHdr3D &hdr, rarray<T,3> *image)
+  {
+  // check data file
+  CheckMhdImageDataFile3D<T>(hdr);
+  if ((uint64_t)(*image).size() != GetNumberOfVoxels3D(hdr.voxels))
+    EchoExit(" Size of rarray does not fit Mhd image size of '" + hdr.filenameRaw + "'");
+  // same type and byte order on disk: read straight into the image, otherwise convert (and swap) block by block
+  MhdRawReader raw(hdr);
+  if (IsNativeRawData<T>(hdr))
+    raw.read((*image).data(), (uint64_t)(*image).size() * sizeof(T));
+  else
+    {
+    const size_t blockElements = 1 << 20;
+    std::vector<uint8_t> rawBlock(blockElements * elementTypeSize[hdr.elementType]);
+    for (size_t i0 = 0; i0 < (size_t)(*image).size(); i0 += blockElements)
+      {
+      const size_t n = std::min(blockElements, (size_t)(*image).size() - i0);
+      raw.read(rawBlock.data(), n * elementTypeSize[hdr.elementType]);
+      ConvertRawElements(rawBlock.data(), hdr.elementType, (*image).data() + i0, n, NeedsByteSwap(hdr));
+      }
     }
-  ifFile.close();
   }
 
-#define READ_IMAGE(TYPE, HDR, IMAGE) \
-  { \
-  rarray<TYPE,3> t(HDR.voxels.z, HDR.voxels.y, HDR.voxels.x); \
-  ReadMhdImage3D(HDR, &t); \
-  for (int z = 0; z < HDR.voxels.z; z++) \
-    for (int y = 0; y < HDR.voxels.y; y++) \
-      for (int x = 0; x < HDR.voxels.x; x++) \
-        IMAGE[z][y][x] = t[z][y][x]; \
-  t.clear(); \
+// Read-only view of a mhd image: if the type on disk is T, the rarray points directly into the mapped raw
+// file (no copy, only touched pages become resident); otherwise (or if compressed or big-endian) the data
+// are converted (and byte swapped) once into T.
+template <typename T> class MhdImageView3D
+  {
+  public:
+    explicit MhdImageView3D(const mhdHdr3D &hdr)
+      {
+      CheckMhdImageDataFile3D<T>(hdr);
+      const uint64_t offset = hdr.filenamesRaw.empty() ? GetMhdRawDataOffset(hdr, hdr.filenameRaw) : 0;
+      if (IsNativeRawData<T>(hdr) && !hdr.compressedData && hdr.filenamesRaw.empty() && offset % alignof(T) == 0)
+        {
+        raw.reset(new MappedFile(hdr.filenameRaw));
+        view = rarray<const T,3>(reinterpret_cast<const T*>(static_cast<const uint8_t*>(raw->data()) + offset), 
+                                 hdr.voxels.z, hdr.voxels.y, hdr.voxels.x);
+        }
+      else
+        {
+        converted = rarray<T,3>(hdr.voxels.z, hdr.voxels.y, hdr.voxels.x);
+        ReadMhdImage3D(hdr, &converted);
+        view = rarray<const T,3>(converted.data(), hdr.voxels.z, hdr.voxels.y, hdr.voxels.x);
+        }
+      }
+    const rarray<const T,3>& image() const { return view; }
+    bool isMapped() const { return raw != nullptr; }
+  private:
+    std::unique_ptr<MappedFile> raw;
+    rarray<T,3>                 converted;
+    rarray<const T,3>           view;
+  };
+
+// number of z-slices per slab so that a slab of T takes about maxBytes of memory (at least one slice)
+template <typename T> int GetSlabHeight(const mhdHdr3D &hdr, size_t maxBytes = 64 << 20)
+  {
+  const size_t sliceBytes = (size_t)hdr.voxels.x * hdr.voxels.y * sizeof(T);
+  return (int)std::max<size_t>(1, std::min<size_t>(hdr.voxels.z, maxBytes / std::max<size_t>(1, sliceBytes)));
+  }
+
+// Signed axis permutation of a 3D image (tilts, mirrors and their combinations): output axis a (0 = x, 1 = y, 
+// 2 = z) runs along input axis axis[a], reversed if flip[a].
+struct axisPermutation3D
+  {
+  std::array<int,3>  axis = {{ 0, 1, 2 }};
+  std::array<bool,3> flip = {{ false, false, false }};
+  };
+
+template <typename V> V PermuteAxes3D(const V &in, const axisPermutation3D &p)
+  {
+  const decltype(in.x) v[3] = { in.x, in.y, in.z };
+  return V(v[p.axis[0]], v[p.axis[1]], v[p.axis[2]]);
+  }
+
+// the permutation that applies first and then second
+static axisPermutation3D ComposeAxisPermutations3D(const axisPermutation3D &first, const axisPermutation3D &second)
+  {
+  axisPermutation3D p;
+  for (int a = 0; a < 3; a++)
+    {
+    p.axis[a] = first.axis[second.axis[a]];
+    p.flip[a] = first.flip[second.axis[a]] != second.flip[a];
+    }
+  return p;
+  }
+
+// Permutation of a tilt-mhd code: +x/-x rotate by +-90 degrees around x, ++x/--x by 180 degrees (y and z alike).
+// suffix is the file name suffix of the tilted image, e.g. "+xx-tilted". Returns false for unknown codes.
+static bool GetTiltAxisPermutation3D(const std::string &code, axisPermutation3D &p, std::string &suffix)
+  {
+  static const std::vector<std::pair<std::string, axisPermutation3D>> tilts = 
+    {
+    {  "+x", { {{ 0, 2, 1 }}, {{ false, false, true  }} } }, // out[z][y][x] = in[y][Z-1-z][x]
+    {  "-x", { {{ 0, 2, 1 }}, {{ false, true,  false }} } }, // out[z][y][x] = in[Y-1-y][z][x]
+    {  "+y", { {{ 2, 1, 0 }}, {{ false, false, true  }} } }, // out[z][y][x] = in[x][y][Z-1-z]
+    {  "-y", { {{ 2, 1, 0 }}, {{ true,  false, false }} } }, // out[z][y][x] = in[X-1-x][y][z]
+    {  "+z", { {{ 1, 0, 2 }}, {{ false, true,  false }} } }, // out[z][y][x] = in[z][x][Y-1-y]
+    {  "-z", { {{ 1, 0, 2 }}, {{ true,  false, false }} } }, // out[z][y][x] = in[z][X-1-x][y]
+    { "++x", { {{ 0, 1, 2 }}, {{ false, true,  true  }} } }, // out[z][y][x] = in[Z-1-z][Y-1-y][x]
+    { "--x", { {{ 0, 1, 2 }}, {{ false, true,  true  }} } },
+    { "++y", { {{ 0, 1, 2 }}, {{ true,  false, true  }} } }, // out[z][y][x] = in[Z-1-z][y][X-1-x]
+    { "--y", { {{ 0, 1, 2 }}, {{ true,  false, true  }} } },
+    { "++z", { {{ 0, 1, 2 }}, {{ true,  true,  false }} } }, // out[z][y][x] = in[z][Y-1-y][X-1-x]
+    { "--z", { {{ 0, 1, 2 }}, {{ true,  true,  false }} } },
+    };
+  for (const auto &tilt : tilts)
+    if (tilt.first == code)
+      {
+      p      = tilt.second;
+      suffix = code.substr(0, 1) + std::string(code.size() - 1, code.back()) + "-tilted"; // "++x" -> "+xx-tilted"
+      return true;
+      }
+  return false;
+  }
+
+// Permutation of a mirror-mhd code -x, -y or -z; suffix is e.g. "-x-mirrored". Returns false for unknown codes.
+static bool GetMirrorAxisPermutation3D(const std::string &code, axisPermutation3D &p, std::string &suffix)
+  {
+  if (code != "-x" && code != "-y" && code != "-z") return false;
+  p = axisPermutation3D();
+  p.flip[code[1] - 'x'] = true;
+  suffix = code + "-mirrored";
+  return true;
+  }
+
+// Orientation recorded in the header instead of the voxels (lazy orientation): TransformMatrix row i is the 
+// direction of index axis i. For a signed permutation p (the image materialized by p has the identity matrix), 
+// index axis p.axis[a] runs along -+axis a, so row p.axis[a] is -+unit vector a.
+static std::array<double,9> GetAxisPermutationTransformMatrix3D(const axisPermutation3D &p)
+  {
+  std::array<double,9> m = {{ 0, 0, 0, 0, 0, 0, 0, 0, 0 }};
+  for (int a = 0; a < 3; a++)
+    m[3 * p.axis[a] + a] = p.flip[a] ? -1 : 1;
+  return m;
+  }
+
+// The permutation that materializes the TransformMatrix of hdr; false if the matrix is not a signed permutation
+// (an arbitrary rotation cannot be materialized without resampling).
+static bool GetTransformMatrixAxisPermutation3D(const mhdHdr3D &hdr, axisPermutation3D &p)
+  {
+  std::array<bool,3> used = {{ false, false, false }};
+  for (int i = 0; i < 3; i++)
+    {
+    int a = -1;
+    for (int j = 0; j < 3; j++)
+      if (std::fabs(std::fabs(hdr.transformMatrix[3 * i + j]) - 1) < 1e-6) a = j;
+      else if (std::fabs(hdr.transformMatrix[3 * i + j]) > 1e-6) return false;
+    if (a < 0 || used[a]) return false;
+    used[a]   = true;
+    p.axis[a] = i;
+    p.flip[a] = hdr.transformMatrix[3 * i + a] < 0;
+    }
+  return true;
+  }
+
+// AnatomicalOrientation (one letter per index axis, e.g. "RAI") of an image permuted by p: the letters follow
+// their axes, flips keep them. A flipped axis still points the same way (the identity matrix and the Offset of
+// an eager orientation place the voxels mirrored), which is also why mirror-mhd -i leaves the header unchanged.
+static std::string PermuteAnatomicalOrientation3D(const std::string &orientation, const axisPermutation3D &p)
+  {
+  if (orientation.size() != 3) return orientation;
+  std::string permuted(3, ' ');
+  for (int a = 0; a < 3; a++)
+    permuted[a] = orientation[p.axis[a]];
+  return permuted;
+  }
+
+// Computes the output slices [z0, z0 + slices) of the permuted image in (of inVoxels) into out (slice z0 first).
+// A naive loop over the output reads the input along a strided axis for all but the trivial permutations, so 
+// nearly every voxel costs a cache and TLB miss. Here the output is cut into tiles of up to 64 voxels along the
+// axis c that is contiguous in the input, times whole rows: each tile is gathered into a row buffer reading runs of
+// consecutive input voxels (whole cache lines), then the rows are copied out. The buffer rows are padded, since
+// power-of-two row lengths would map all of them onto the same cache sets. The tiles are distributed over all
+// threads.
+template <typename T>
+void PermuteImageSlab(const T *in, intxyz inVoxels, const axisPermutation3D &p, T *out, int z0, int slices)
+  {
+  const int64_t inDim[3]    = { inVoxels.x, inVoxels.y, inVoxels.z };
+  const int64_t inStride[3] = { 1, inDim[0], inDim[0] * inDim[1] };
+  int64_t dim[3], step[3], base = 0; // input offset of output voxel (x, y, z): base + x*step[0] + y*step[1] + z*step[2]
+  for (int a = 0; a < 3; a++)
+    {
+    dim[a]  = inDim[p.axis[a]];
+    step[a] = inStride[p.axis[a]];
+    if (p.flip[a]) { base += (dim[a] - 1) * step[a]; step[a] = -step[a]; }
+    }
+  const int64_t rowVoxels = dim[0], sliceVoxels = dim[0] * dim[1];
+  // 1. x stays the contiguous input axis: plain (or reversed) row copies
+  if (step[0] == 1 || step[0] == -1)
+    {
+    ParallelFor(0, slices, [&](size_t s)
+      {
+      const int64_t z = z0 + s;
+      for (int64_t y = 0; y < dim[1]; y++)
+        {
+        const T *src = in + base + z * step[2] + y * step[1];
+        T       *dst = out + s * sliceVoxels + y * rowVoxels;
+        if (step[0] == 1) std::copy(src, src + rowVoxels, dst);
+        else 
+          { // the row is still in L1 when it is reversed
+          std::copy(src - rowVoxels + 1, src + 1, dst);
+          ReverseElements<sizeof(T)>(dst, rowVoxels);
+          }
+        }
+      });
+    return;
+    }
+  // 2. tiles of 64 (c) x 1 (the other axis o) output rows
+  const int     c = (step[1] == 1 || step[1] == -1) ? 1 : 2, o = 3 - c;
+  const int64_t outStride[3] = { 1, rowVoxels, sliceVoxels };
+  const int64_t pitch = rowVoxels + 64 / sizeof(T) + 1; // padded row buffer stride
+  int64_t tile[3] = { rowVoxels, 1, 1 };
+  tile[c] = 64;
+  const int64_t tilesY = (dim[1] + tile[1] - 1) / tile[1], tilesZ = (slices + tile[2] - 1) / tile[2];
+  ParallelFor(0, tilesY * tilesZ, [&](size_t t)
+    {
+    int64_t b[3], e[3]; // tile begin and end
+    b[2] = z0 + (t / tilesY) * tile[2];
+    b[1] = (t % tilesY) * tile[1];
+    e[2] = std::min<int64_t>(b[2] + tile[2], z0 + slices);
+    e[1] = std::min<int64_t>(b[1] + tile[1], dim[1]);
+    const int64_t n = e[c] - b[c], xStep = step[0];
+    const T *src0 = in + base + b[c] * step[c] + b[o] * step[o];
+    T       *dst0 = out + (b[2] - z0) * sliceVoxels + b[1] * rowVoxels;
+    thread_local std::vector<T> rows;
+    rows.resize(n * pitch);
+    // 2.1 gather: for every x a run of n consecutive input voxels
+    for (int64_t x = 0; x < rowVoxels; x++)
+      {
+      const T *src = src0 + x * xStep;
+      T       *dst = rows.data() + x;
+      if (step[c] == 1) for (int64_t k = 0; k < n; k++) dst[k * pitch] = src[k];
+      else              for (int64_t k = 0; k < n; k++) dst[k * pitch] = src[-k];
+      }
+    // 2.2 output rows
+    for (int64_t k = 0; k < n; k++)
+      std::copy_n(rows.data() + k * pitch, rowVoxels, dst0 + k * outStride[c]);
+    });
+  }
+
+// Reads a mhd image as consecutive z-slabs of (up to) slabHeight slices, converted into T. Memory is bounded by two
+// slabs: the next slab is read by a background thread while the current one is processed.
+//   MhdSlabReader3D<uint8_t> reader(hdr, 16);
+//   while (reader.next()) { const rarray<uint8_t,3> &slab = reader.slab(); ... reader.z0() ... }
+template <typename T> class MhdSlabReader3D
+  {
+  public:
+    MhdSlabReader3D(const mhdHdr3D &hdr, int slabHeight) 
+      : hdr(hdr), slabHeight(std::max(1, std::min(slabHeight, hdr.voxels.z))), 
+        sliceVoxels((size_t)hdr.voxels.x * hdr.voxels.y), raw((CheckMhdImageDataFile3D<T>(hdr), hdr))
+      {
+      for (int b = 0; b < 2; b++)
+        {
+        buffers[b].resize((size_t)this->slabHeight * sliceVoxels);
+        if (!IsNativeRawData<T>(hdr))
+          rawBuffers[b].resize((size_t)this->slabHeight * sliceVoxels * elementTypeSize[hdr.elementType]);
+        }
+      if (hdr.voxels.z > 0) Prefetch(0, 0);
+      }
+    ~MhdSlabReader3D() { if (pending.valid()) pending.wait(); }
+    MhdSlabReader3D(const MhdSlabReader3D&) = delete;
+    MhdSlabReader3D& operator = (const MhdSlabReader3D&) = delete;
+    // makes the next slab current; returns false when all slabs have been read
+    bool next()
+      {
+      if (!pending.valid()) return false;
+      pending.get();
+      current       = prefetchBuffer;
+      currentZ0     = prefetchZ0;
+      currentSlices = prefetchSlices;
+      currentSlab   = rarray<T,3>(buffers[current].data(), currentSlices, hdr.voxels.y, hdr.voxels.x);
+      if (currentZ0 + currentSlices < hdr.voxels.z) Prefetch(1 - current, currentZ0 + currentSlices);
+      return true;
+      }
+    const rarray<T,3>& slab() const { return currentSlab; } // [slice][y][x]
+    int z0()     const { return currentZ0; }                  // z of the first slice of the current slab
+    int slices() const { return currentSlices; }
+  private:
+    void Prefetch(int buffer, int z0)
+      {
+      prefetchBuffer = buffer;
+      prefetchZ0     = z0;
+      prefetchSlices = std::min(slabHeight, hdr.voxels.z - z0);
+      pending = std::async(std::launch::async, [this]() { Read(prefetchBuffer, prefetchSlices); });
+      }
+    void Read(int buffer, int slices) // slabs are read strictly in order, so the stream position is always right
+      {
+      const size_t n = (size_t)slices * sliceVoxels;
+      if (rawBuffers[buffer].empty())
+        raw.read(buffers[buffer].data(), n * sizeof(T));
+      else
+        {
+        raw.read(rawBuffers[buffer].data(), n * elementTypeSize[hdr.elementType]);
+        ConvertRawElements(rawBuffers[buffer].data(), hdr.elementType, buffers[buffer].data(), n, NeedsByteSwap(hdr));
+        }
+      }
+    const mhdHdr3D                hdr;
+    const int                     slabHeight;
+    const size_t                  sliceVoxels;
+    MhdRawReader                  raw;
+    std::vector<T>                buffers[2];
+    std::vector<uint8_t>          rawBuffers[2];
+    std::future<void>             pending;
+    int                           prefetchBuffer = 0, prefetchZ0 = 0, prefetchSlices = 0;
+    int                           current = 0, currentZ0 = 0, currentSlices = 0;
+    rarray<T,3>                   currentSlab;
+  };
+
+// Writes a mhd image of T slab by slab (in z order); the header is written on construction and the total number
+// of voxels is checked against it on close(). Completed slabs are handed to a background writer thread through a
+// bounded queue (maxQueued slabs), so the caller computes the next slab while the previous one is written; at most
+// maxQueued + 2 slabs are in memory. With hdr.compressedData the writer thread also deflates each slab (in
+// parallel) into one zlib stream and the header is rewritten with CompressedDataSize on close().
+//   MhdSlabWriter3D<float> writer(hdr);
+//   for (...) { vector<float> slab = writer.acquire(); slab.resize(n); ...; writer.write(move(slab)); }
+//   writer.close();
+template <typename T> class MhdSlabWriter3D
+  {
+  public:
+    explicit MhdSlabWriter3D(const mhdHdr3D &hdr, size_t maxQueued = 2) 
+      : hdr(hdr), numberOfVoxels(GetNumberOfVoxels3D(hdr.voxels)), maxQueued(std::max<size_t>(1, maxQueued))
+      {
+      GetNumberOfBytes3D(hdr.voxels, sizeof(T)); // validates the size
+      WriteMhdHeader3D(GetWrittenMhdHdr3D<T>(hdr));
+      ofFile.open(hdr.filenameRaw, std::ios::binary);
+      if (!ofFile) EchoExit("Could not open raw file '" + hdr.filenameRaw + "' for writing");
+      if (hdr.compressedData) deflater.reset(new ParallelDeflater());
+      writerThread = std::thread([this]() { WriteQueued(); });
+      }
+    ~MhdSlabWriter3D() { close(); }
+    MhdSlabWriter3D(const MhdSlabWriter3D&) = delete;
+    MhdSlabWriter3D& operator = (const MhdSlabWriter3D&) = delete;
+    // returns an empty buffer for the next slab, reusing the memory of a slab that has already been written
+    std::vector<T> acquire()
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (spare.empty()) return std::vector<T>();
+      std::vector<T> slab = std::move(spare.back());
+      spare.pop_back();
+      slab.clear();
+      return slab;
+      }
+    // queues the slab for writing; blocks while maxQueued slabs are waiting
+    void write(std::vector<T> &&slab)
+      {
+      if (writtenVoxels + slab.size() > numberOfVoxels)
+        EchoExit("More voxels written into '" + hdr.filenameRaw + "' than the header number of voxels");
+      writtenVoxels += slab.size();
+      std::unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, [this]() { return queue.size() < maxQueued; });
+      queue.push_back(std::move(slab));
+      changed.notify_all();
+      }
+    void write(const T *data, size_t voxels)
+      {
+      std::vector<T> slab = acquire();
+      slab.assign(data, data + voxels);
+      write(std::move(slab));
+      }
+    void write(const rarray<T,3> &slab) { write(slab.data(), slab.size()); }
+    // hands over buffers (e.g. of a previous writer) for acquire() to reuse
+    void recycle(std::vector<std::vector<T>> &&buffers)
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto &buffer : buffers) spare.push_back(std::move(buffer));
+      buffers.clear();
+      }
+    // after close(): takes the slab buffers back, e.g. to recycle() them into the writer of the next file
+    std::vector<std::vector<T>> releaseBuffers()
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      return std::move(spare);
+      }
+    void close()
+      {
+      if (!writerThread.joinable()) return;
+        {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+        }
+      changed.notify_all();
+      writerThread.join();
+      if (deflater)
+        {
+        deflater->finish(compressed);
+        WriteCompressed();
+        }
+      const uint64_t fileBytes = ofFile.tellp();
+      ofFile.close();
+      if (ofFile.fail()) EchoExit("Could not close raw file '" + hdr.filenameRaw + "'");
+      if (writtenVoxels != numberOfVoxels)
+        EchoExit("Number of voxels written into '" + hdr.filenameRaw + "' does not match header number of voxels");
+      if (deflater) // now that the compressed size is known
+        WriteMhdHeader3D(GetWrittenMhdHdr3D<T>(hdr), fileBytes);
+      }
+  private:
+    void WriteQueued() // writer thread: writes slabs in queue order until closed and drained
+      {
+      std::unique_lock<std::mutex> lock(mutex);
+      for (;;)
+        {
+        changed.wait(lock, [this]() { return !queue.empty() || closing; });
+        if (queue.empty()) return;
+        std::vector<T> slab = std::move(queue.front());
+        queue.pop_front();
+        changed.notify_all(); // there is room in the queue again
+        lock.unlock();
+        if (deflater)
+          {
+          deflater->compress(slab.data(), slab.size() * sizeof(T), compressed);
+          WriteCompressed();
+          }
+        else
+          WriteRawBytes(ofFile, slab.data(), (uint64_t)slab.size() * sizeof(T), hdr.filenameRaw);
+        lock.lock();
+        spare.push_back(std::move(slab));
+        }
+      }
+    void WriteCompressed()
+      {
+      WriteRawBytes(ofFile, compressed.data(), compressed.size(), hdr.filenameRaw);
+      compressed.clear();
+      }
+    const mhdHdr3D                    hdr;
+    std::ofstream                     ofFile;
+    std::unique_ptr<ParallelDeflater> deflater; // if hdr.compressedData
+    std::vector<uint8_t>              compressed;
+    const uint64_t                    numberOfVoxels;
+    uint64_t                          writtenVoxels = 0;
+    const size_t                      maxQueued;
+    std::mutex                        mutex;
+    std::condition_variable           changed;
+    std::deque<std::vector<T>>        queue;
+    std::vector<std::vector<T>>       spare; // written slabs whose memory is reused by acquire()
+    bool                              closing = false;
+    std::thread                       writerThread;
+  };
+
+// Header of an image derived from inHdr (same element type, modality, compression, Offset and AnatomicalOrientation),
+// written next to the input with suffix appended to the file names, e.g. "phantom.mhd" -> "phantom+x-tilted.mhd"; 
+// dimensions (and an Offset that moves with them) are left to the caller. A lazily oriented header shares the raw file of its source, so its raw name is derived from the
+// header name.
+static mhdHdr3D GetDerivedMhdHdr3D(const mhdHdr3D &inHdr, const std::string &suffix)
+  {
+  const bool         lazy = inHdr.transformMatrix != mhdHdr3D().transformMatrix;
+  const std::string &base = lazy ? inHdr.filenameMhd : inHdr.filenameRaw;
+  mhdHdr3D outHdr;
+  outHdr.filenameMhd    = inHdr.filenameMhd.substr(0, inHdr.filenameMhd.find_last_of('.')) + suffix + ".mhd";
+  outHdr.filenameRaw    = base.substr(0, base.find_last_of('.')) + suffix + 
+                          std::filesystem::path(inHdr.filenameRaw).extension().string();
+  outHdr.elementType    = inHdr.elementType;
+  outHdr.modality       = inHdr.modality;
+  outHdr.compressedData = inHdr.compressedData;
+  outHdr.voxels         = inHdr.voxels;
+  outHdr.voxelSize      = inHdr.voxelSize;
+  outHdr.offset         = inHdr.offset;
+  outHdr.anatomicalOrientation = inHdr.anatomicalOrientation;
+  return outHdr;
+  }
+
+// the pending orientation of a lazily oriented image (identity if its TransformMatrix is not a signed permutation;
+// such a matrix is dropped, as before lazy orientation)
+static axisPermutation3D GetMhdAxisPermutation3D(const mhdHdr3D &hdr)
+  {
+  axisPermutation3D p;
+  return GetTransformMatrixAxisPermutation3D(hdr, p) ? p : axisPermutation3D();
+  }
+
+// Offset of the image materialized from hdr (identity matrix): the Offset of a lazily oriented header is the world 
+// position of its first raw voxel, which is the last voxel along the axes its pending orientation flips.
+static doublexyz GetMaterializedMhdOffset3D(const mhdHdr3D &hdr)
+  {
+  const axisPermutation3D p         = GetMhdAxisPermutation3D(hdr);
+  const intxyz            voxels    = PermuteAxes3D(hdr.voxels, p);
+  const doublexyz         voxelSize = PermuteAxes3D(hdr.voxelSize, p);
+  doublexyz offset = hdr.offset;
+  for (int a = 0; a < 3; a++)
+    if (p.flip[a]) offset[a] -= (voxels[a] - 1) * voxelSize[a];
+  return offset;
+  }
+
+// World position of the (fractional) voxel index of the image of hdr, e.g. the Offset of a box starting there: the 
+// rows of the TransformMatrix are the world directions of the index axes
+static doublexyz GetMhdWorldPosition3D(const mhdHdr3D &hdr, doublexyz index)
+  {
+  doublexyz position = hdr.offset;
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      position[j] += hdr.transformMatrix[3 * i + j] * index[i] * hdr.voxelSize[i];
+  return position;
+  }
+
+// Writes the image of inHdr (element type T) permuted by p to outHdr in a single pass; outHdr.voxels/voxelSize/
+// offset are set here (the Offset components are permuted along with the axes). A pending (lazy) orientation of 
+// inHdr is applied first, so the output has the identity matrix.
+// The output is computed slab by slab with PermuteImageSlab; each completed slab is queued to the writer thread,
+// so the next slab is computed while the previous one is written. The slab buffers are kept per thread for the
+// next image, so a batch of images does not allocate (and page fault) them again.
+template <typename T> void WritePermutedImage3D(const mhdHdr3D &inHdr, const axisPermutation3D &p, mhdHdr3D &outHdr)
+  {
+  thread_local std::vector<std::vector<T>> slabBuffers;
+  MhdImageView3D<T> inView(inHdr);
+  const axisPermutation3D q = ComposeAxisPermutations3D(GetMhdAxisPermutation3D(inHdr), p);
+  outHdr.voxels    = PermuteAxes3D(inHdr.voxels, q);
+  outHdr.voxelSize = PermuteAxes3D(inHdr.voxelSize, q);
+  outHdr.offset    = PermuteAxes3D(GetMaterializedMhdOffset3D(inHdr), p);
+  outHdr.anatomicalOrientation = PermuteAnatomicalOrientation3D(inHdr.anatomicalOrientation, q);
+  MhdSlabWriter3D<T> writer(outHdr);
+  writer.recycle(std::move(slabBuffers));
+  const int slabHeight = GetSlabHeight<T>(outHdr, 16 << 20);
+  for (int z0 = 0; z0 < outHdr.voxels.z; z0 += slabHeight)
+    {
+    const int slices = std::min(slabHeight, outHdr.voxels.z - z0);
+    std::vector<T> slab = writer.acquire();
+    slab.resize((size_t)slices * outHdr.voxels.y * outHdr.voxels.x);
+    PermuteImageSlab(inView.image().data(), inHdr.voxels, q, slab.data(), z0, slices);
+    writer.write(std::move(slab));
+    }
+  writer.close();
+  slabBuffers = writer.releaseBuffers();
+  }
+
+// Writes every image of inMhdFilenames permuted by p, with suffix appended to its file names, and returns the
+// output header file names. The images are processed concurrently by a pool of threads (one per image, at most 
+// one per core); the cores left over are used by the slab kernels of each image.
+static std::vector<std::string> WritePermutedImages3D(const std::vector<std::string> &inMhdFilenames, 
+                                                      const axisPermutation3D &p, const std::string &suffix)
+  {
+  std::vector<std::string> outMhdFilenames(inMhdFilenames.size());
+  ParallelFor(0, inMhdFilenames.size(), [&](size_t i)
+    {
+    const mhdHdr3D inHdr  = ReadMhdHeader3D(inMhdFilenames[i]);
+    mhdHdr3D       outHdr = GetDerivedMhdHdr3D(inHdr, suffix);
+    VisitElementType(inHdr.elementType, [&](auto tag)
+      { WritePermutedImage3D<typename decltype(tag)::type>(inHdr, p, outHdr); });
+    outMhdFilenames[i] = outHdr.filenameMhd;
+    });
+  return outMhdFilenames;
+  }
+
+// Lazy version of WritePermutedImages3D: writes only a header per image that records p in TransformMatrix (see
+// GetAxisPermutationTransformMatrix3D) and refers to the unchanged raw data of the input, so orienting costs a
+// header write instead of a pass over the voxels. DimSize, ElementSpacing and AnatomicalOrientation stay with the
+// index axes; Offset is set so that the image lies where the materialized one does. Readers that honour 
+// TransformMatrix (ITK: RTK, Aliza, ...) see the oriented image; the voxels are rewritten only by 
+// MaterializeMhdImages3D (or any eager orientation) when a consumer needs the layout.
+static std::vector<std::string> WriteLazilyPermutedMhdHeaders3D(const std::vector<std::string> &inMhdFilenames,
+                                                                const axisPermutation3D &p, const std::string &suffix)
+  {
+  std::vector<std::string> outMhdFilenames;
+  for (const std::string &inMhdFilename : inMhdFilenames)
+    {
+    mhdHdr3D hdr = ReadMhdHeader3D(inMhdFilename);
+    axisPermutation3D pending;
+    if (!GetTransformMatrixAxisPermutation3D(hdr, pending))
+      EchoExit(" TransformMatrix of '" + inMhdFilename + "' is not an axis permutation, it cannot be oriented lazily");
+    const axisPermutation3D q = ComposeAxisPermutations3D(pending, p);
+    // the first raw voxel lies where the image written by WritePermutedImage3D has it: its Offset is that of the 
+    // input, permuted by p, plus the extent of the axes q flips
+    const intxyz    voxels    = PermuteAxes3D(hdr.voxels, q);
+    const doublexyz voxelSize = PermuteAxes3D(hdr.voxelSize, q);
+    const doublexyz offset    = PermuteAxes3D(GetMaterializedMhdOffset3D(hdr), p);
+    for (int a = 0; a < 3; a++)
+      hdr.offset[a] = offset[a] + (q.flip[a] ? (voxels[a] - 1) * voxelSize[a] : 0);
+    hdr.transformMatrix = GetAxisPermutationTransformMatrix3D(q);
+    hdr.filenameMhd     = inMhdFilename.substr(0, inMhdFilename.find_last_of('.')) + suffix + ".mhd";
+    WriteMhdHeader3D(hdr, hdr.compressedDataSize);
+    outMhdFilenames.push_back(hdr.filenameMhd);
+    }
+  return outMhdFilenames;
+  }
+
+// Rewrites the voxels of lazily oriented images into the layout of their TransformMatrix: each header is replaced
+// by one with the identity matrix and its own raw data file (named after the header). Images without a pending 
+// orientation are left as they are.
+static void MaterializeMhdImages3D(const std::vector<std::string> &mhdFilenames)
+  {
+  ParallelFor(0, mhdFilenames.size(), [&](size_t i)
+    {
+    const mhdHdr3D inHdr = ReadMhdHeader3D(mhdFilenames[i]);
+    if (inHdr.transformMatrix == mhdHdr3D().transformMatrix) return;
+    mhdHdr3D outHdr = GetDerivedMhdHdr3D(inHdr, "");
+    if (outHdr.filenameRaw == inHdr.filenameRaw)
+      EchoExit(" '" + mhdFilenames[i] + "' shares its raw data file name, it cannot be materialized in place");
+    VisitElementType(inHdr.elementType, [&](auto tag)
+      { WritePermutedImage3D<typename decltype(tag)::type>(inHdr, axisPermutation3D(), outHdr); });
+    });
+  }
+
+// Mirrors the voxels of a mapped image along axis (0 = x, 1 = y, 2 = z) in place: rows are reversed with
+// ReverseElements (x), rows (y) or slices (z) are swapped pairwise. Only the element size matters, so any type and 
+// byte order works.
+template <size_t BYTES> void MirrorImageInPlace(uint8_t *data, intxyz voxels, int axis)
+  {
+  const size_t rowBytes = (size_t)voxels.x * BYTES, sliceBytes = rowBytes * voxels.y;
+  if (axis == 2)
+    ParallelFor(0, voxels.z / 2, [&](size_t z)
+      {
+      uint8_t *a = data + z * sliceBytes, *b = data + (voxels.z - 1 - z) * sliceBytes;
+      std::swap_ranges(a, a + sliceBytes, b);
+      });
+  else
+    ParallelFor(0, voxels.z, [&](size_t z)
+      {
+      uint8_t *slice = data + z * sliceBytes;
+      if (axis == 0)
+        for (int y = 0; y < voxels.y; y++)
+          ReverseElements<BYTES>(slice + y * rowBytes, voxels.x);
+      else
+        for (int y = 0; y < voxels.y / 2; y++)
+          std::swap_ranges(slice + y * rowBytes, slice + (y + 1) * rowBytes, slice + (voxels.y - 1 - y) * rowBytes);
+      });
+  }
+
+// Mirrors the raw data file of hdr in place through a shared writable mapping (no second image in memory, no
+// second file); the header is unchanged. The data must be uncompressed and fill a file of their own: a HeaderSize
+// or a larger raw file means other headers (e.g. the zero-copy crops of crop-mhd) may share it.
+static void MirrorMhdImageInPlace(const mhdHdr3D &hdr, int axis)
+  {
+  if (hdr.compressedData || !hdr.filenamesRaw.empty())
+    EchoExit(" '" + hdr.filenameMhd + "' can only be mirrored in place if its data are uncompressed in one file");
+  if (hdr.headerSizeGiven)
+    EchoExit(" '" + hdr.filenameMhd + "' has a HeaderSize, its raw data file may be shared with other headers; "
+             "copy it first (crop-mhd -c)");
+  if (hdr.transformMatrix != mhdHdr3D().transformMatrix)
+    EchoExit(" '" + hdr.filenameMhd + "' has a TransformMatrix (e.g. a pending lazy orientation), it cannot be "
+             "mirrored in place");
+  if (hdr.elementNumberOfChannels != 1)
+    EchoExit(" ElementNumberOfChannels of '" + hdr.filenameMhd + "' is not 1 (only scalar images are supported)");
+  const uint64_t bytes  = GetNumberOfBytes3D(hdr.voxels, elementTypeSize[hdr.elementType]);
+  const uint64_t offset = GetMhdRawDataOffset(hdr, hdr.filenameRaw);
+  MappedFile raw(hdr.filenameRaw, true);
+  if (raw.size() < offset + bytes) EchoExit(" File size of '" + hdr.filenameRaw + " does not fit Mhd image size");
+  if (raw.size() != offset + bytes)
+    EchoExit(" '" + hdr.filenameRaw + "' is larger than the image of '" + hdr.filenameMhd + "', it may be shared "
+             "with other headers; copy it first (crop-mhd -c)");
+  uint8_t *data = static_cast<uint8_t*>(raw.writableData()) + offset;
+  switch (elementTypeSize[hdr.elementType])
+    {
+    case 1: MirrorImageInPlace<1>(data, hdr.voxels, axis); break;
+    case 2: MirrorImageInPlace<2>(data, hdr.voxels, axis); break;
+    case 4: MirrorImageInPlace<4>(data, hdr.voxels, axis); break;
+    case 8: MirrorImageInPlace<8>(data, hdr.voxels, axis); break;
+    default: EchoExit(" Element type of file '" + hdr.filenameRaw + "' not supported");
+    }
+  }
+
+// Rotation of a 3D image by angle about the x axis through its centre, as Gate places a volume with 
+// setRotationAxis 1 0 0 / setRotationAngle (active and right-handed: +y turns into +z). The x axis is unchanged, so 
+// every output row is an input row (nearest neighbour) or a blend of the 4 input rows around the rotated position 
+// (linear; trilinear reduces to bilinear in y-z, since x stays on the input grid).
+struct rotationX3D
+  {
+  double    cosA, sinA;
+  intxyz    inVoxels, outVoxels;
+  doublexyz voxelSize; // same for input and output
+  // input (fractional) y and z index of the centre of output row (y, z)
+  void inputYZ(int y, int z, double &inY, double &inZ) const
+    {
+    const double py = (y - 0.5 * (outVoxels.y - 1)) * voxelSize.y, pz = (z - 0.5 * (outVoxels.z - 1)) * voxelSize.z;
+    inY = ( cosA * py + sinA * pz) / voxelSize.y + 0.5 * (inVoxels.y - 1);
+    inZ = (-sinA * py + cosA * pz) / voxelSize.z + 0.5 * (inVoxels.z - 1);
+    }
+  };
+
+// The output grid keeps the voxel size and is the smallest one that contains the rotated input, centred on it (so
+// a Gate placement by translation is not affected).
+static rotationX3D GetRotationX3D(intxyz inVoxels, doublexyz voxelSize, double angleDeg)
+  {
+  rotationX3D r;
+  const double a = angleDeg * M_PI / 180.;
+  r.cosA = cos(a), r.sinA = sin(a);
+  // exact for multiples of 90 deg, so e.g. 90 deg gives the grid (and voxels) of a tilt
+  if (std::fmod(angleDeg, 90.) == 0.) r.cosA = std::round(r.cosA), r.sinA = std::round(r.sinA);
+  r.inVoxels  = inVoxels;
+  r.voxelSize = voxelSize;
+  const double extentY = inVoxels.y * voxelSize.y, extentZ = inVoxels.z * voxelSize.z;
+  r.outVoxels = intxyz(inVoxels.x,
+                       (int)std::ceil((std::fabs(r.cosA) * extentY + std::fabs(r.sinA) * extentZ) / voxelSize.y - 1e-6),
+                       (int)std::ceil((std::fabs(r.sinA) * extentY + std::fabs(r.cosA) * extentZ) / voxelSize.z - 1e-6));
+  return r;
+  }
+
+// out[x] = w[0] * row[0][x] + ... + w[3] * row[3][x], rounded for integer T; a plain loop that the compiler 
+// vectorizes, built for AVX2/FMA and for the baseline (SSE2) and picked at run time
+template <typename T, typename W> inline __attribute__((always_inline)) 
+void BlendRowsBody(const T *const row[4], const W w[4], T *out, size_t n)
+  {
+  const T *r0 = row[0], *r1 = row[1], *r2 = row[2], *r3 = row[3];
+  for (size_t x = 0; x < n; x++)
+    {
+    const W v = w[0] * r0[x] + w[1] * r1[x] + w[2] * r2[x] + w[3] * r3[x];
+    out[x] = std::is_integral<T>::value ? T(std::floor(v + W(0.5))) : T(v);
+    }
+  }
+
+template <typename T, typename W> void BlendRowsScalar(const T *const row[4], const W w[4], T *out, size_t n)
+  { BlendRowsBody(row, w, out, n); }
+
+template <typename T, typename W> __attribute__((target("avx2,fma")))
+void BlendRowsAVX2(const T *const row[4], const W w[4], T *out, size_t n)
+  { BlendRowsBody(row, w, out, n); }
+
+template <typename T, typename W> void BlendRows(const T *const row[4], const W w[4], T *out, size_t n)
+  {
+  static const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  if (avx2) BlendRowsAVX2(row, w, out, n);
+  else      BlendRowsScalar(row, w, out, n);
+  }
+
+// Computes the output slices [z0, z0 + slices) of the rotation r of in into out; input voxels outside the image
+// are background. The slices are distributed over all threads.
+template <typename T>
+void RotateImageXSlab(const T *in, const rotationX3D &r, bool linear, T background, T *out, int z0, int slices)
+  {
+  typedef typename std::conditional<(sizeof(T) <= 2 || std::is_same<T,float>::value), float, double>::type W;
+  const size_t rowVoxels = r.outVoxels.x, sliceVoxels = rowVoxels * r.outVoxels.y;
+  const std::vector<T> backgroundRow(rowVoxels, background);
+  // input row (y, z), or the background row if outside
+  auto inRow = [&](int64_t y, int64_t z) -> const T*
+    {
+    if (y < 0 || y >= r.inVoxels.y || z < 0 || z >= r.inVoxels.z) return backgroundRow.data();
+    return in + (z * r.inVoxels.y + y) * rowVoxels;
+    };
+  ParallelFor(0, slices, [&](size_t s)
+    {
+    for (int y = 0; y < r.outVoxels.y; y++)
+      {
+      T *dst = out + s * sliceVoxels + y * rowVoxels;
+      double inY, inZ;
+      r.inputYZ(y, z0 + (int)s, inY, inZ);
+      if (!linear)
+        {
+        const T *src = inRow((int64_t)std::floor(inY + 0.5), (int64_t)std::floor(inZ + 0.5));
+        std::copy(src, src + rowVoxels, dst);
+        continue;
+        }
+      const int64_t y0 = (int64_t)std::floor(inY), iz0 = (int64_t)std::floor(inZ);
+      const W fy = W(inY - y0), fz = W(inZ - iz0);
+      const T *row[4] = { inRow(y0, iz0), inRow(y0 + 1, iz0), inRow(y0, iz0 + 1), inRow(y0 + 1, iz0 + 1) };
+      const W  w[4]   = { (1 - fy) * (1 - fz), fy * (1 - fz), (1 - fy) * fz, fy * fz };
+      BlendRows(row, w, dst, rowVoxels);
+      }
+    });
+  }
+
+// Writes the image of inHdr (element type T) rotated by angleDeg about x to outHdr (see rotationX3D), in slabs
+// queued to the writer thread as in WritePermutedImage3D; outHdr.voxels and offset are set here (the output grid
+// has the centre of the input grid).
+template <typename T> 
+void WriteRotatedXImage3D(const mhdHdr3D &inHdr, double angleDeg, bool linear, T background, mhdHdr3D &outHdr)
+  {
+  MhdImageView3D<T> inView(inHdr);
+  const rotationX3D r = GetRotationX3D(inHdr.voxels, inHdr.voxelSize, angleDeg);
+  outHdr.voxels    = r.outVoxels;
+  outHdr.voxelSize = inHdr.voxelSize;
+  outHdr.offset    = GetMhdWorldPosition3D(inHdr, doublexyz(0, 0.5 * (inHdr.voxels.y - r.outVoxels.y), 
+                                                                 0.5 * (inHdr.voxels.z - r.outVoxels.z)));
+  MhdSlabWriter3D<T> writer(outHdr);
+  const int slabHeight = GetSlabHeight<T>(outHdr, 16 << 20);
+  for (int z0 = 0; z0 < outHdr.voxels.z; z0 += slabHeight)
+    {
+    const int slices = std::min(slabHeight, outHdr.voxels.z - z0);
+    std::vector<T> slab = writer.acquire();
+    slab.resize((size_t)slices * outHdr.voxels.y * outHdr.voxels.x);
+    RotateImageXSlab(inView.image().data(), r, linear, background, slab.data(), z0, slices);
+    writer.write(std::move(slab));
+    }
+  writer.close();
+  }
+
+// Box of voxels [min, max] (inclusive) of a 3D image
+struct voxelBox3D
+  {
+  intxyz min, max;
+  intxyz voxels() const { return max - min + intxyz(1); }
+  };
+
+// Copies the box of the image of inHdr (element type T) into outHdr (outHdr.voxels and offset are set here): each output row 
+// is one contiguous run of the input row (for full-width boxes whole slices are contiguous); with a mapped input
+// only the pages of the box are read. Slabs are queued to the writer thread as in WritePermutedImage3D.
+template <typename T> void WriteCroppedImage3D(const mhdHdr3D &inHdr, const voxelBox3D &box, mhdHdr3D &outHdr)
+  {
+  MhdImageView3D<T> inView(inHdr);
+  const T *in = inView.image().data();
+  outHdr.voxels = box.voxels();
+  outHdr.offset = GetMhdWorldPosition3D(inHdr, doublexyz(box.min.x, box.min.y, box.min.z));
+  const size_t rowVoxels = outHdr.voxels.x, sliceVoxels = rowVoxels * outHdr.voxels.y;
+  const size_t inRowVoxels = inHdr.voxels.x, inSliceVoxels = inRowVoxels * inHdr.voxels.y;
+  const bool   fullRows = (rowVoxels == inRowVoxels);
+  MhdSlabWriter3D<T> writer(outHdr);
+  const int slabHeight = GetSlabHeight<T>(outHdr, 16 << 20);
+  for (int z0 = 0; z0 < outHdr.voxels.z; z0 += slabHeight)
+    {
+    const int slices = std::min(slabHeight, outHdr.voxels.z - z0);
+    std::vector<T> slab = writer.acquire();
+    slab.resize(slices * sliceVoxels);
+    ParallelFor(0, slices, [&](size_t s)
+      {
+      const T *src = in + (box.min.z + z0 + s) * inSliceVoxels + (size_t)box.min.y * inRowVoxels + box.min.x;
+      T       *dst = slab.data() + s * sliceVoxels;
+      if (fullRows) std::copy_n(src, sliceVoxels, dst);
+      else
+        for (int y = 0; y < outHdr.voxels.y; y++)
+          std::copy_n(src + y * inRowVoxels, rowVoxels, dst + y * rowVoxels);
+      });
+    writer.write(std::move(slab));
+    }
+  writer.close();
+  }
+
+// Tight box of the voxels that are not background (isBackground(value) false) in one pass: each row is scanned from
+// both ends up to its first foreground voxel only; the slices are distributed over all threads. An image without
+// foreground gives an empty box (min > max).
+template <typename T, typename F> voxelBox3D GetForegroundBox3D(const T *image, intxyz voxels, F isBackground)
+  {
+  const voxelBox3D empty = { voxels, intxyz(-1) };
+  std::vector<voxelBox3D> sliceBoxes(voxels.z, empty);
+  ParallelFor(0, voxels.z, [&](size_t z)
+    {
+    voxelBox3D &box = sliceBoxes[z];
+    for (int y = 0; y < voxels.y; y++)
+      {
+      const T *row = image + ((size_t)z * voxels.y + y) * voxels.x;
+      int x0 = 0, x1 = voxels.x - 1;
+      while (x0 < voxels.x && isBackground(row[x0])) x0++;
+      if (x0 == voxels.x) continue;
+      while (isBackground(row[x1])) x1--;
+      box.min = intxyz(std::min(box.min.x, x0), std::min(box.min.y, y), (int)z);
+      box.max = intxyz(std::max(box.max.x, x1), y, (int)z);
+      }
+    });
+  voxelBox3D box = empty;
+  for (const voxelBox3D &sliceBox : sliceBoxes)
+    for (int a = 0; a < 3; a++)
+      {
+      box.min[a] = std::min(box.min[a], sliceBox.min[a]);
+      box.max[a] = std::max(box.max[a], sliceBox.max[a]);
+      }
+  return box;
+  }
+
+// Header of a z-range of the image of inHdr without copying: it refers to the input raw data file, with HeaderSize
+// (always written) skipping the slices below box.min.z, and the Offset of slice box.min.z. Only for full x-y boxes of uncompressed data in one file; returns false
+// otherwise.
+static bool GetZeroCopyCroppedMhdHdr3D(const mhdHdr3D &inHdr, const voxelBox3D &box, mhdHdr3D &outHdr)
+  {
+  if (inHdr.compressedData || !inHdr.filenamesRaw.empty() || inHdr.elementNumberOfChannels != 1 ||
+      box.min.x != 0 || box.min.y != 0 || box.max.x != inHdr.voxels.x - 1 || box.max.y != inHdr.voxels.y - 1)
+    return false;
+  const uint64_t sliceBytes = GetNumberOfBytes3D(intxyz(inHdr.voxels.x, inHdr.voxels.y, 1), 
+                                                 elementTypeSize[inHdr.elementType]);
+  const mhdHdr3D derivedHdr = outHdr;
+  outHdr             = inHdr;
+  outHdr.filenameMhd = derivedHdr.filenameMhd;
+  outHdr.voxels      = box.voxels();
+  outHdr.offset      = GetMhdWorldPosition3D(inHdr, doublexyz(box.min.x, box.min.y, box.min.z));
+  outHdr.headerSize  = GetMhdRawDataOffset(inHdr, inHdr.filenameRaw) + box.min.z * sliceBytes;
+  outHdr.headerSizeGiven = true; // also HeaderSize = 0 (box.min.z = 0): the file holds more than the box
+  return true;
+  }
+
+// Majority vote (mode) downsampling of a label image by factor in x, y and z: each output voxel is the most 
+// frequent label of its factor^3 block (the smallest one of equally frequent labels), blocks at the upper borders
+// are partial. Labels are never mixed, unlike with averaging. Output slices are distributed over all threads; each
+// output row gathers its blocks from factor^2 input rows.
+template <typename T> void WriteModeDownsampledImage3D(const mhdHdr3D &inHdr, int factor, mhdHdr3D &outHdr)
+  {
+  MhdImageView3D<T> inView(inHdr);
+  const T *in = inView.image().data();
+  const intxyz inVoxels = inHdr.voxels;
+  outHdr.voxels    = intxyz((inVoxels.x + factor - 1) / factor, (inVoxels.y + factor - 1) / factor, 
+                            (inVoxels.z + factor - 1) / factor);
+  outHdr.voxelSize = inHdr.voxelSize * double(factor);
+  outHdr.offset    = GetMhdWorldPosition3D(inHdr, doublexyz(0.5 * (factor - 1))); // centre of the first block
+  const size_t rowVoxels = outHdr.voxels.x, sliceVoxels = rowVoxels * outHdr.voxels.y;
+  MhdSlabWriter3D<T> writer(outHdr);
+  const int slabHeight = GetSlabHeight<T>(outHdr, 16 << 20);
+  for (int z0 = 0; z0 < outHdr.voxels.z; z0 += slabHeight)
+    {
+    const int slices = std::min(slabHeight, outHdr.voxels.z - z0);
+    std::vector<T> slab = writer.acquire();
+    slab.resize(slices * sliceVoxels);
+    ParallelFor(0, slices, [&](size_t s)
+      {
+      thread_local std::vector<T> block;
+      const int iz0 = (z0 + (int)s) * factor, iz1 = std::min(iz0 + factor, inVoxels.z);
+      for (int y = 0; y < outHdr.voxels.y; y++)
+        {
+        const int iy0 = y * factor, iy1 = std::min(iy0 + factor, inVoxels.y);
+        T *dst = slab.data() + s * sliceVoxels + y * rowVoxels;
+        for (int x = 0; x < outHdr.voxels.x; x++)
+          {
+          const int ix0 = x * factor, ix1 = std::min(ix0 + factor, inVoxels.x);
+          block.clear();
+          for (int iz = iz0; iz < iz1; iz++)
+            for (int iy = iy0; iy < iy1; iy++)
+              {
+              const T *row = in + ((size_t)iz * inVoxels.y + iy) * inVoxels.x;
+              block.insert(block.end(), row + ix0, row + ix1);
+              }
+          T mode = block[0];
+          if constexpr (sizeof(T) == 1)
+            { // count in a table (reset through the block values)
+            thread_local std::array<uint32_t,256> counts = {};
+            uint32_t modeCount = 0;
+            for (T v : block)
+              {
+              const uint32_t count = ++counts[(uint8_t)v];
+              if (count > modeCount || (count == modeCount && v < mode)) { mode = v; modeCount = count; }
+              }
+            for (T v : block) counts[(uint8_t)v] = 0;
+            }
+          else
+            { // longest run of the sorted block
+            std::sort(block.begin(), block.end());
+            size_t modeCount = 0;
+            for (size_t i = 0, j; i < block.size(); i = j)
+              {
+              for (j = i + 1; j < block.size() && block[j] == block[i]; j++) ;
+              if (j - i > modeCount) { mode = block[i]; modeCount = j - i; }
+              }
+            }
+          dst[x] = mode;
+          }
+        }
+      });
+    writer.write(std::move(slab));
+    }
+  writer.close();
+  }
+
+// out[i] = values[labels[i]] for i in [0, n), returns 1 if a label has no valid bit; a plain loop without branches
+// that the compiler vectorizes (with gathers for AVX2), built for AVX2 and for the baseline and picked at run time
+template <typename T, typename V> inline __attribute__((always_inline)) 
+uint64_t LookupLabelsBody(const T *labels, size_t n, const V *values, const uint64_t *valid, V *out)
+  {
+  uint64_t invalid = 0;
+  for (size_t i = 0; i < n; i++)
+    {
+    const T label = labels[i];
+    out[i]   = values[label];
+    invalid |= ~valid[label >> 6] >> (label & 63);
+    }
+  return invalid & 1;
+  }
+
+template <typename T, typename V> 
+uint64_t LookupLabelsScalar(const T *labels, size_t n, const V *values, const uint64_t *valid, V *out)
+  { return LookupLabelsBody(labels, n, values, valid, out); }
+
+template <typename T, typename V> __attribute__((target("avx2")))
+uint64_t LookupLabelsAVX2(const T *labels, size_t n, const V *values, const uint64_t *valid, V *out)
+  { return LookupLabelsBody(labels, n, values, valid, out); }
+
+template <typename T, typename V> 
+uint64_t LookupLabels(const T *labels, size_t n, const V *values, const uint64_t *valid, V *out)
+  {
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2 ? LookupLabelsAVX2(labels, n, values, valid, out) : LookupLabelsScalar(labels, n, values, valid, out);
+  }
+
+// Dense label -> value table of a label image of type T (256 entries for uint8_t, 65536 for uint16_t) with a bitmap
+// of the labels that have a value, so a voxel is looked up with one indexed load instead of a search of the list
+template <typename T, typename V> class LabelLut
+  {
+  static_assert(std::is_unsigned<T>::value && sizeof(T) <= 2, "LabelLut needs an 8 or 16 bit label type");
+  public:
+    LabelLut() : values(size_t(1) << (8 * sizeof(T)), V()), valid((values.size() + 63) / 64, 0) {}
+    // assigns value to label unless it has one (the first listing wins); labels outside the range of T are ignored
+    void set(int64_t label, V value)
+      {
+      if (label < 0 || label >= (int64_t)values.size() || contains((T)label)) return;
+      values[label] = value;
+      valid[label >> 6] |= uint64_t(1) << (label & 63);
+      }
+    bool contains(T label) const { return (valid[label >> 6] >> (label & 63)) & 1; }
+    const V& operator [] (T label) const { return values[label]; }
+    // out[i] = value of labels[i] for i in [0, n), in chunks on all threads; a chunk only remembers whether it met a
+    // label without value. Returns the index of the first such label, or n.
+    size_t lookup(const T *labels, size_t n, V *out) const
+      {
+      const size_t chunkSize = 1 << 16, chunks = (n + chunkSize - 1) / chunkSize;
+      std::vector<uint8_t> missing(chunks, 0);
+      ParallelFor(0, chunks, [&](size_t c)
+        {
+        const size_t begin = c * chunkSize, end = std::min(n, begin + chunkSize);
+        missing[c] = LookupLabels(labels + begin, end - begin, values.data(), valid.data(), out + begin);
+        });
+      for (size_t c = 0; c < chunks; c++)
+        if (missing[c])
+          for (size_t i = c * chunkSize; i < std::min(n, (c + 1) * chunkSize); i++)
+            if (!contains(labels[i])) return i;
+      return n;
+      }
+  private:
+    std::vector<V>        values;
+    std::vector<uint64_t> valid;
+  };
+
+// counts[label] += 1 for the n labels; for 8 bit labels into four interleaved sub-histograms, so consecutive equal
+// labels do not wait for each other's increment (n < 2^32 per call), built for AVX2 and for the baseline and picked
+// at run time
+template <typename T> inline __attribute__((always_inline)) void CountLabelsBody(const T *labels, size_t n, 
+                                                                                 uint64_t *counts)
+  {
+  if constexpr (sizeof(T) == 1)
+    {
+    uint32_t sub[4][256] = {};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+      {
+      sub[0][labels[i]]++;
+      sub[1][labels[i+1]]++;
+      sub[2][labels[i+2]]++;
+      sub[3][labels[i+3]]++;
+      }
+    for (; i < n; i++) sub[0][labels[i]]++;
+    for (int l = 0; l < 256; l++)
+      counts[l] += (uint64_t)sub[0][l] + sub[1][l] + sub[2][l] + sub[3][l];
+    }
+  else
+    for (size_t i = 0; i < n; i++) counts[labels[i]]++;
+  }
+
+template <typename T> void CountLabelsScalar(const T *labels, size_t n, uint64_t *counts)
+  { CountLabelsBody(labels, n, counts); }
+
+template <typename T> __attribute__((target("avx2"))) void CountLabelsAVX2(const T *labels, size_t n, uint64_t *counts)
+  { CountLabelsBody(labels, n, counts); }
+
+template <typename T> void CountLabels(const T *labels, size_t n, uint64_t *counts)
+  {
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  avx2 ? CountLabelsAVX2(labels, n, counts) : CountLabelsScalar(labels, n, counts);
+  }
+
+// Histogram of a label image of type T, indexed by the label (256 bins for uint8_t, 65536 for uint16_t):
+//   LabelHistogram<uint8_t> histogram; histogram.add(labels, n); ... histogram[label] ...
+// add() splits the labels into one contiguous part per thread, counts each part into its own histogram and merges
+// the partial histograms at the end
+template <typename T> class LabelHistogram
+  {
+  static_assert(std::is_unsigned<T>::value && sizeof(T) <= 2, "LabelHistogram needs an 8 or 16 bit label type");
+  public:
+    LabelHistogram() : counts(size_t(1) << (8 * sizeof(T)), 0) {}
+    void add(const T *labels, size_t n)
+      {
+      const unsigned parts = (unsigned)std::min<size_t>(std::max(1u, parallelForThreads ? parallelForThreads 
+                                                                      : std::thread::hardware_concurrency()),
+                                                        (n + chunkSize - 1) / chunkSize);
+      if (parts <= 1) { AddPart(labels, n, counts.data()); return; }
+      std::vector<std::vector<uint64_t>> partCounts(parts, std::vector<uint64_t>(counts.size(), 0));
+      ParallelFor(0, parts, [&](size_t p)
+        {
+        const size_t begin = n * p / parts, end = n * (p + 1) / parts;
+        AddPart(labels + begin, end - begin, partCounts[p].data());
+        });
+      for (const std::vector<uint64_t> &part : partCounts)
+        for (size_t l = 0; l < counts.size(); l++) counts[l] += part[l];
+      }
+    // number of voxels of label; 0 for labels outside the range of T
+    uint64_t operator [] (int64_t label) const 
+      { return (label < 0 || label >= (int64_t)counts.size()) ? 0 : counts[label]; }
+    size_t   size()  const { return counts.size(); }
+    uint64_t total() const { return std::accumulate(counts.begin(), counts.end(), uint64_t(0)); }
+  private:
+    static constexpr size_t chunkSize = 1 << 20; // per CountLabels() call, far below its 2^32 counts
+    static void AddPart(const T *labels, size_t n, uint64_t *counts)
+      {
+      for (size_t i = 0; i < n; i += chunkSize)
+        CountLabels(labels + i, std::min(n - i, chunkSize), counts);
+      }
+    std::vector<uint64_t> counts;
+  };
+
+// Histogram of the label image of hdr (type T), streamed in z-slabs
+template <typename T> LabelHistogram<T> GetLabelHistogram3D(const mhdHdr3D &hdr)
+  {
+  LabelHistogram<T>  histogram;
+  MhdSlabReader3D<T> reader(hdr, GetSlabHeight<T>(hdr));
+  while (reader.next())
+    histogram.add(reader.slab().data(), reader.slab().size());
+  return histogram;
+  }
+
+// Checks that every label of the label image of inHdr (type T) has a value in lut, with a histogram pass before 
+// anything is written; stops at the first label without a value (with its position)
+template <typename T, typename V> void CheckLabelLutImage3D(const mhdHdr3D &inHdr, const LabelLut<T,V> &lut)
+  {
+  const LabelHistogram<T> histogram = GetLabelHistogram3D<T>(inHdr);
+  bool complete = true;
+  for (size_t label = 0; label < histogram.size(); label++)
+    if (histogram[label] && !lut.contains((T)label)) complete = false;
+  if (complete) return;
+  // only on failure: find the first voxel of a missing label for the message
+  MhdSlabReader3D<T> reader(inHdr, GetSlabHeight<T>(inHdr));
+  const ra::size_type sliceVoxels = (ra::size_type)inHdr.voxels.x * inHdr.voxels.y;
+  while (reader.next())
+    {
+    const rarray<T,3> &labelSlab = reader.slab();
+    for (ra::size_type i = 0; i < labelSlab.size(); i++)
+      if (!lut.contains(labelSlab.data()[i]))
+        ECHO_ERROR("There is a label (%d) in the atlas image at [%d][%d][%d] that is not listed in the range file!",
+                   labelSlab.data()[i], reader.z0() + (int)(i / sliceVoxels), 
+                   (int)(i % sliceVoxels / inHdr.voxels.x), (int)(i % inHdr.voxels.x));
+    }
+  }
+
+// Streams the label image of inHdr (type T) in z-slabs and writes the values lut[label] to outHdr as soon as a slab
+// is looked up; all labels are checked by CheckLabelLutImage3D() before the output files are created, so a label 
+// without a value does not leave a truncated image behind
+template <typename T, typename V> void WriteLabelLutImage3D(const mhdHdr3D &inHdr, const LabelLut<T,V> &lut, 
+                                                            const mhdHdr3D &outHdr)
+  {
+  CheckLabelLutImage3D(inHdr, lut);
+  MhdSlabReader3D<T> reader(inHdr, GetSlabHeight<V>(inHdr));
+  MhdSlabWriter3D<V> writer(outHdr);
+  while (reader.next())
+    {
+    const rarray<T,3> &labelSlab = reader.slab();
+    std::vector<V> valueSlab = writer.acquire(); // written by the writer thread while the next slab is read
+    valueSlab.resize(labelSlab.size());
+    lut.lookup(labelSlab.data(), valueSlab.size(), valueSlab.data());
+    writer.write(std::move(valueSlab));
+    }
+  writer.close();
   }
 
 template <typename T>
@@ -327,67 +2137,77 @@ void WriteMhd3DImage(const std::string &filenameMhd, rarray<T,3> image, intxyz v
                      const std::string &modalityString = "MET_MOD_OTHER")
   {
   const std::string filenameRaw = filenameMhd.substr(0, filenameMhd.find_last_of('.')) + ".raw";
-   // write header
-  std::ofstream ofFile;
-  ofFile.open(filenameMhd);
-  if (!ofFile) EchoExit("Could not open raw file '" + filenameMhd + "' for writing");
-  ofFile << "ObjectType = Image\n";
-  ofFile << "BinaryData = True\n";
-  ofFile << "BinaryDataByteOrderMSB = False\n";
-  ofFile << "CompressedData = False\n";
-  ofFile << "Modality = " << modalityString << "\n";
-  ofFile << "NDims = 3\n";
-  ofFile << "DimSize = " << voxels.x << " " << voxels.y << " " << voxels.z << "\n";
-  ofFile << "ElementType = " << GetElementTypeString<T>();
-  ofFile << "ElementSize = " << voxelSize.x << " " << voxelSize.y << " " << voxelSize.z << "\n";
-  ofFile << "ElementSpacing = " << voxelSize.x << " " << voxelSize.y << " " << voxelSize.z << "\n";
-  ofFile << "ElementDataFile = " << filenameRaw << "\n";
-  ofFile.close();
+  // write header
+  mhdHdr3D hdr;
+  hdr.filenameMhd = filenameMhd;
+  hdr.filenameRaw = filenameRaw;
+  hdr.voxels      = voxels;
+  hdr.voxelSize   = voxelSize;
+  hdr.modality    = modalityString;
+  WriteMhdHeader3D(GetWrittenMhdHdr3D<T>(hdr));
   // write data
+  std::ofstream ofFile;
   ofFile.open(filenameRaw, std::ios::binary);
   if (!ofFile) EchoExit("Could not raw file '" + filenameRaw + "' for writing");
-  ofFile.write(reinterpret_cast<char*>(image.data()), image.size() * sizeof(T));
+  const uint64_t numberOfBytes = GetNumberOfBytes3D(voxels, sizeof(T));
+  if ((uint64_t)image.size() * sizeof(T) != numberOfBytes)
+    EchoExit("Size of rarray does not match number of voxels of '" + filenameMhd + "'");
+  WriteRawBytes(ofFile, image.data(), numberOfBytes, filenameRaw);
   ofFile.close();
   }
 
 template <typename T> void WriteMhd3DImage(const mhdHdr3D hdr, rarray<T,3> image)
   {
-  // write header
-  std::ofstream ofFile;
-  ofFile.open(hdr.filenameMhd);
-  if (!ofFile) EchoExit("Could not open raw file '" + hdr.filenameMhd + "' for writing");
-  ofFile << "ObjectType = Image\n";
-  ofFile << "BinaryData = True\n";
-  ofFile << "BinaryDataByteOrderMSB = False\n";
-  ofFile << "CompressedData = False\n";
-  ofFile << "Modality = " << hdr.modality << "\n";
-  ofFile << "NDims = 3\n";
-  ofFile << "DimSize = " << hdr.voxels.x << " " << hdr.voxels.y << " " << hdr.voxels.z << "\n";
-  ofFile << "ElementType = " << GetElementTypeString<T>();
-  ofFile << "ElementSize = " << hdr.voxelSize.x << " " << hdr.voxelSize.y << " " << hdr.voxelSize.z << "\n";
-  ofFile << "ElementSpacing = " << hdr.voxelSize.x << " " << hdr.voxelSize.y << " " << hdr.voxelSize.z << "\n";
-  ofFile << "ElementDataFile = " << hdr.filenameRaw << "\n";
-  ofFile.close();
-  // write data
-  ofFile.open(hdr.filenameRaw, std::ios::binary);
-  if (!ofFile) 
-    EchoExit("Could not raw open file '" + hdr.filenameRaw + "' for writing");
-  const uint32_t numberOfBytes = sizeof(T) * hdr.voxels.x * hdr.voxels.y * hdr.voxels.z;
-  ofFile.write(reinterpret_cast<char*>(image.data()), image.size() * sizeof(T));
-  if (ofFile.tellp() != numberOfBytes)
+  // write data (the header needs the size of compressed data)
+  const uint64_t numberOfBytes = GetNumberOfBytes3D(hdr.voxels, sizeof(T));
+  if ((uint64_t)image.size() * sizeof(T) != numberOfBytes)
+    EchoExit("Size of rarray does not match header number of voxels of '" + hdr.filenameMhd + "'");
+  const uint64_t fileBytes = WriteMhdRawData3D(hdr.filenameRaw, image.data(), numberOfBytes, hdr.compressedData);
+  if (!hdr.compressedData && fileBytes != numberOfBytes)
     EchoExit("Number of bytes written does not match header number of voxels");
-  ofFile.close();
+  // write header
+  WriteMhdHeader3D(GetWrittenMhdHdr3D<T>(hdr), fileBytes);
   }
 
-#define WRITE_IMAGE(TYPE, VOXELS, VOXELSIZE, IMAGE, HDR_FILENAME) \
-  { \
-  rarray<TYPE,3> t(VOXELS.z, VOXELS.y, VOXELS.x); \
-  for (int z = 0; z < VOXELS.z; z++) \
-    for (int y = 0; y < VOXELS.y; y++) \
-      for (int x = 0; x < VOXELS.x; x++) \
-        t[z][y][x] = (TYPE)IMAGE[z][y][x]; \
-  WriteMhd3DImage(HDR_FILENAME, t, VOXELS, VOXELSIZE); \
-  t.clear(); \
+// writes image as TOUT, converting one slab at a time while the previous slab is written (no full-size temporary)
+template <typename TOUT, typename T>
+void WriteMhd3DImageAs(const std::string &filenameMhd, const rarray<T,3> &image, intxyz voxels, doublexyz voxelSize,
+                       const std::string &modalityString = "MET_MOD_OTHER")
+  {
+  mhdHdr3D hdr;
+  hdr.filenameMhd = filenameMhd;
+  hdr.filenameRaw = filenameMhd.substr(0, filenameMhd.find_last_of('.')) + ".raw";
+  hdr.elementType = GetElementTypeOf<TOUT>();
+  hdr.voxels      = voxels;
+  hdr.voxelSize   = voxelSize;
+  hdr.modality    = modalityString;
+  if ((uint64_t)image.size() != GetNumberOfVoxels3D(voxels))
+    EchoExit("Size of rarray does not match number of voxels of '" + filenameMhd + "'");
+  MhdSlabWriter3D<TOUT> writer(hdr);
+  const size_t sliceVoxels = (size_t)voxels.x * voxels.y;
+  const int    slabHeight  = GetSlabHeight<TOUT>(hdr, 16 << 20);
+  for (int z0 = 0; z0 < voxels.z; z0 += slabHeight)
+    {
+    const size_t n = (size_t)std::min(slabHeight, voxels.z - z0) * sliceVoxels;
+    const T *in = image.data() + z0 * sliceVoxels;
+    std::vector<TOUT> slab = writer.acquire();
+    slab.resize(n);
+    for (size_t i = 0; i < n; i++)
+      slab[i] = static_cast<TOUT>(in[i]);
+    writer.write(std::move(slab));
+    }
+  writer.close();
+  }
+
+// writes an (unsigned) label or count image with the smallest element type that holds maxValue
+template <typename T>
+void WriteMhd3DImageFittingMax(const std::string &filenameMhd, const rarray<T,3> &image, intxyz voxels, 
+                               doublexyz voxelSize, uint64_t maxValue)
+  {
+  if      (maxValue < UINT8_MAX)  WriteMhd3DImageAs<uint8_t>(filenameMhd, image, voxels, voxelSize);
+  else if (maxValue < UINT16_MAX) WriteMhd3DImageAs<uint16_t>(filenameMhd, image, voxels, voxelSize);
+  else if (maxValue < UINT32_MAX) WriteMhd3DImageAs<uint32_t>(filenameMhd, image, voxels, voxelSize);
+  else                            WriteMhd3DImageAs<uint64_t>(filenameMhd, image, voxels, voxelSize);
   }
 
 #endif // MISC
@@ -0,0 +1,63 @@
+#include "misc.h"
+
+using namespace std;
+
+int main(int argc, char *argv[])
+  {
+  const bool lazy        = (argc > 1 && strcmp("-l", argv[1]) == 0);
+  const bool materialize = (argc > 1 && strcmp("-m", argv[1]) == 0);
+  if (materialize)
+    { // 0. Rewrite the voxels of lazily oriented images
+    if (argc < 3) ECHO_ERROR("$ orient-mhd -m <in.mhd> [<in.mhd> ...]");
+    const vector<string> mhdFilenames(argv + 2, argv + argc);
+    for (const string &mhdFilename : mhdFilenames)
+      if (!filesystem::exists(mhdFilename))
+        ECHO_ERROR("'%s' does not exist", mhdFilename.c_str());
+    MaterializeMhdImages3D(mhdFilenames);
+    // the following strings are used in musire.sh
+    for (const string &mhdFilename : mhdFilenames)
+      cout << mhdFilename << endl;
+    return 0;
+    }
+  const int start = lazy ? 2 : 1; // first input file argument
+  int first = start; // first step argument
+  while (first < argc && strcmp("tilt", argv[first]) != 0 && strcmp("mirror", argv[first]) != 0) first++;
+  if (first == start || first == argc || (argc - first) % 2 != 0)
+    ECHO_ERROR("$ orient-mhd [-l] <in.mhd> [<in.mhd> ...] <tilt|mirror> <code> [<tilt|mirror> <code> ...]\n"
+               "$ orient-mhd -m <in.mhd> [<in.mhd> ...]\n"
+               "  Applies a chain of tilts (codes as tilt-mhd: -x|--x|+x|++x|-y|...|++z) and mirrors (codes as\n"
+               "  mirror-mhd: -x|-y|-z) in one pass: the chain is reduced to a single axis permutation with flips,\n"
+               "  so each image is read and written once and no intermediate files are written. The output file is\n"
+               "  named as the chain of tools would have named it, e.g.\n"
+               "    orient-mhd raw.mhd tilt ++z mirror -x  ->  raw+zz-tilted-x-mirrored.mhd\n"
+               "  Several images (e.g. a glob) are processed concurrently in one process. With -l (lazy) only a\n"
+               "  header is written that records the orientation in TransformMatrix and refers to the input raw\n"
+               "  data; -m materializes such images when a consumer needs the voxels in that layout: the header is\n"
+               "  replaced by one with its own raw data file and the identity TransformMatrix.");
+  const vector<string> inMhdFilenames(argv + start, argv + first);
+  for (const string &inMhdFilename : inMhdFilenames)
+    if (!filesystem::exists(inMhdFilename))
+      ECHO_ERROR("'%s' does not exist", inMhdFilename.c_str());
+
+  // 1. Compose the chain
+  axisPermutation3D orientation;
+  string str;
+  for (int i = first; i < argc; i += 2)
+    {
+    axisPermutation3D step;
+    string stepStr;
+    const bool valid = (strcmp("tilt", argv[i]) == 0)   ? GetTiltAxisPermutation3D(argv[i+1], step, stepStr) :
+                       (strcmp("mirror", argv[i]) == 0) ? GetMirrorAxisPermutation3D(argv[i+1], step, stepStr) : false;
+    if (!valid) ECHO_ERROR("orient-mhd: invalid step '%s %s'", argv[i], argv[i+1]);
+    orientation = ComposeAxisPermutations3D(orientation, step);
+    str += stepStr;
+    }
+
+  // 2. Read, permute and write each image in one pass (or only record the orientation in its header)
+  const vector<string> outMhdFilenames = lazy ? WriteLazilyPermutedMhdHeaders3D(inMhdFilenames, orientation, str)
+                                              : WritePermutedImages3D(inMhdFilenames, orientation, str);
+  // the following strings are used in musire.sh
+  for (const string &outMhdFilename : outMhdFilenames)
+    cout << outMhdFilename << endl;
+  return 0;
+  }
@@ -0,0 +1,55 @@
+#include "misc.h"
+
+using namespace std;
+
+int main(int argc, char *argv[])
+  {
+  // 1. Options
+  int  first = 1; // first input file argument
+  char interpolation = 0; // 'n'earest neighbour, 'l'inear or 0: by element type
+  double background = 0;
+  for (; first < argc && argv[first][0] == '-' && !isdigit(argv[first][1]) && argv[first][1] != '.'; first++)
+    if      (strcmp("-n", argv[first]) == 0) interpolation = 'n';
+    else if (strcmp("-l", argv[first]) == 0) interpolation = 'l';
+    else if (strcmp("-b", argv[first]) == 0 && first + 1 < argc) background = atof(argv[++first]);
+    else first = argc; // usage
+  if (argc < first + 2)
+    ECHO_ERROR("$ rotate-mhd [-n|-l] [-b <background>] <in.mhd> [<in.mhd> ...] <angleXdeg>\n"
+               "  Rotates images by <angleXdeg> about the x axis through their centre, as Gate does with\n"
+               "  /gate/<volume>/placement/setRotationAxis 1 0 0 and setRotationAngle <angleXdeg> deg, into an axis-\n"
+               "  aligned grid with the same voxel size that contains the whole rotated image (same centre). Integer\n"
+               "  images (labels) are resampled nearest neighbour, float images (density, activity) linearly; -n/-l\n"
+               "  force either. Voxels outside the input are <background> (default 0); for a label image that is\n"
+               "  the label of the surrounding material (e.g. Air). Several images (e.g. a glob) are rotated\n"
+               "  concurrently in one process; the output is <in>-x<angleXdeg>deg-rotated.mhd.");
+  const vector<string> inMhdFilenames(argv + first, argv + argc - 1);
+  for (const string &inMhdFilename : inMhdFilenames)
+    if (!filesystem::exists(inMhdFilename))
+      ECHO_ERROR("'%s' does not exist", inMhdFilename.c_str());
+  char *end;
+  const double angleDeg = strtod(argv[argc-1], &end);
+  if (*end != '\0' || !isfinite(angleDeg))
+    ECHO_ERROR("rotate-mhd: invalid angle '%s'", argv[argc-1]);
+  const string str = string("-x") + argv[argc-1] + "deg-rotated";
+
+  // 2. Resample each image in one pass
+  vector<string> outMhdFilenames(inMhdFilenames.size());
+  ParallelFor(0, inMhdFilenames.size(), [&](size_t i)
+    {
+    const mhdHdr3D inHdr  = ReadMhdHeader3D(inMhdFilenames[i]);
+    if (inHdr.transformMatrix != mhdHdr3D().transformMatrix)
+      EchoExit(" '" + inMhdFilenames[i] + "' has a TransformMatrix, materialize it first (orient-mhd -m)");
+    mhdHdr3D       outHdr = GetDerivedMhdHdr3D(inHdr, str);
+    VisitElementType(inHdr.elementType, [&](auto tag)
+      {
+      typedef typename decltype(tag)::type T;
+      const bool linear = interpolation ? interpolation == 'l' : !is_integral<T>::value;
+      WriteRotatedXImage3D<T>(inHdr, angleDeg, linear, T(background), outHdr);
+      });
+    outMhdFilenames[i] = outHdr.filenameMhd;
+    });
+  // the following strings are used in musire.sh
+  for (const string &outMhdFilename : outMhdFilenames)
+    cout << outMhdFilename << endl;
+  return 0;
+  }
@@ -0,0 +1,135 @@
+#include "../misc.h"
+
+using namespace std;
+
+// Wall time of reading an atlas from its raw data against reading it from its compressed data (.zraw, read and
+// inflate), with ReadMhdImage3D (whole image) and MhdSlabReader3D (streamed z-slabs). Each atlas is copied into a
+// raw and a .zraw file in a temporary directory first; the times are the best of 5 runs (warm page cache).
+//   USAGE: bench-compressed-read [<atlas.mhd> ...]   (default: a synthetic 480 x 480 x 350 MET_UCHAR label atlas;
+//          run it in the directory of the atlases, their data file names are relative to it)
+
+static const int runs = 5;
+
+template <typename F> double BestSeconds(F f)
+  {
+  double best = DBL_MAX;
+  for (int run = 0; run < runs; run++)
+    {
+    const auto t0 = chrono::steady_clock::now();
+    f();
+    best = min(best, chrono::duration<double>(chrono::steady_clock::now() - t0).count());
+    }
+  return best;
+  }
+
+template <typename T> void CopyImage(const mhdHdr3D &inHdr, const mhdHdr3D &outHdr)
+  {
+  MhdSlabReader3D<T> reader(inHdr, GetSlabHeight<T>(inHdr));
+  MhdSlabWriter3D<T> writer(outHdr);
+  while (reader.next())
+    writer.write(reader.slab());
+  writer.close();
+  }
+
+// nested ellipsoids of 12 labels (skin, fat, muscle, bone, ...) and a few organs, as a head/torso atlas
+static void WriteSyntheticAtlas(const mhdHdr3D &hdr)
+  {
+  MhdSlabWriter3D<uint8_t> writer(hdr);
+  const doublexyz centre = doublexyz(hdr.voxels.x, hdr.voxels.y, hdr.voxels.z) * 0.5;
+  for (int z = 0; z < hdr.voxels.z; z++)
+    {
+    vector<uint8_t> slice = writer.acquire();
+    slice.resize((size_t)hdr.voxels.x * hdr.voxels.y);
+    for (int y = 0; y < hdr.voxels.y; y++)
+      for (int x = 0; x < hdr.voxels.x; x++)
+        {
+        const double dx = (x - centre.x) / (0.42 * hdr.voxels.x), dy = (y - centre.y) / (0.32 * hdr.voxels.y),
+                     dz = (z - centre.z) / (0.48 * hdr.voxels.z), r = sqrt(dx * dx + dy * dy + dz * dz);
+        uint8_t label = (r < 1.0) ? uint8_t(1 + int(r * 8.0)) : 0;
+        if (hypot(dx - 0.35, dy) < 0.18 && fabs(dz) < 0.6) label = 10;  // organ
+        if (hypot(dx + 0.35, dy) < 0.18 && fabs(dz) < 0.6) label = 11;  // organ
+        if (hypot(dx, dy + 0.5) < 0.08 && r < 1.0)          label = 12;  // spine
+        slice[(size_t)y * hdr.voxels.x + x] = label;
+        }
+    writer.write(std::move(slice));
+    }
+  writer.close();
+  }
+
+template <typename T> void Benchmark(const mhdHdr3D &inHdr, const filesystem::path &dir)
+  {
+  mhdHdr3D rawHdr = inHdr, zrawHdr = inHdr;
+  rawHdr.filenameMhd  = (dir / "atlas-raw.mhd").string();
+  rawHdr.filenameRaw  = (dir / "atlas-raw.raw").string();
+  rawHdr.compressedData = false;
+  zrawHdr.filenameMhd = (dir / "atlas-zraw.mhd").string();
+  zrawHdr.filenameRaw = (dir / "atlas-zraw.zraw").string();
+  zrawHdr.compressedData = true;
+  CopyImage<T>(inHdr, rawHdr);
+  const double deflateSeconds = BestSeconds([&]() { CopyImage<T>(inHdr, zrawHdr); });
+  const mhdHdr3D raw = ReadMhdHeader3D(rawHdr.filenameMhd), zraw = ReadMhdHeader3D(zrawHdr.filenameMhd);
+  const uint64_t rawBytes  = filesystem::file_size(raw.filenameRaw),
+                 zrawBytes = filesystem::file_size(zraw.filenameRaw);
+
+  auto readImage = [](const mhdHdr3D &hdr)
+    {
+    return BestSeconds([&]()
+      {
+      rarray<T,3> image(hdr.voxels.z, hdr.voxels.y, hdr.voxels.x);
+      ReadMhdImage3D(hdr, &image);
+      });
+    };
+  auto readSlabs = [](const mhdHdr3D &hdr)
+    {
+    return BestSeconds([&]()
+      {
+      MhdSlabReader3D<T> reader(hdr, GetSlabHeight<T>(hdr));
+      while (reader.next()) {}
+      });
+    };
+  const double imageRaw = readImage(raw), imageZraw = readImage(zraw), slabsRaw = readSlabs(raw),
+               slabsZraw = readSlabs(zraw);
+  auto gbs = [&](double seconds) { return rawBytes / seconds * 1e-9; };
+  printf("%s: %d x %d x %d %s\n", inHdr.filenameMhd.c_str(), inHdr.voxels.x, inHdr.voxels.y, inHdr.voxels.z,
+         elementTypeNames[inHdr.elementType]);
+  printf("  raw  %12llu bytes\n", (unsigned long long)rawBytes);
+  printf("  zraw %12llu bytes (%.1fx smaller), written in %.3f s\n", (unsigned long long)zrawBytes,
+         double(rawBytes) / zrawBytes, deflateSeconds);
+  printf("  %-36s %8.3f s %6.2f GB/s\n", "ReadMhdImage3D raw", imageRaw, gbs(imageRaw));
+  printf("  %-36s %8.3f s %6.2f GB/s (%.1fx)\n", "ReadMhdImage3D zraw (read+inflate)", imageZraw, gbs(imageZraw),
+         imageZraw / imageRaw);
+  printf("  %-36s %8.3f s %6.2f GB/s\n", "MhdSlabReader3D raw", slabsRaw, gbs(slabsRaw));
+  printf("  %-36s %8.3f s %6.2f GB/s (%.1fx)\n", "MhdSlabReader3D zraw (read+inflate)", slabsZraw, gbs(slabsZraw),
+         slabsZraw / slabsRaw);
+  for (const mhdHdr3D &hdr : { raw, zraw })
+    {
+    filesystem::remove(hdr.filenameMhd);
+    filesystem::remove(hdr.filenameRaw);
+    }
+  }
+
+int main(int argc, char *argv[])
+  {
+  char dirTemplate[] = "/tmp/bench-compressed-read-XXXXXX";
+  if (!mkdtemp(dirTemplate)) ECHO_ERROR("Could not create a temporary directory");
+  const filesystem::path dir = dirTemplate;
+  vector<mhdHdr3D> atlases;
+  for (int i = 1; i < argc; i++) atlases.push_back(ReadMhdHeader3D(argv[i]));
+  if (atlases.empty())
+    {
+    mhdHdr3D hdr;
+    hdr.filenameMhd = (dir / "synthetic-atlas.mhd").string();
+    hdr.filenameRaw = (dir / "synthetic-atlas.raw").string();
+    hdr.voxels      = intxyz(480, 480, 350);
+    hdr.voxelSize   = doublexyz(0.5);
+    hdr.modality    = "MET_MOD_ATLAS";
+    hdr.elementType = MET_UCHAR;
+    WriteSyntheticAtlas(hdr);
+    atlases.push_back(ReadMhdHeader3D(hdr.filenameMhd));
+    }
+  printf("threads: %u\n", max(1u, thread::hardware_concurrency()));
+  for (const mhdHdr3D &hdr : atlases)
+    VisitElementType(hdr.elementType, [&](auto tag) { Benchmark<typename decltype(tag)::type>(hdr, dir); });
+  filesystem::remove_all(dir);
+  return 0;
+  }
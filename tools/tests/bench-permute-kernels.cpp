@@ -0,0 +1,116 @@
+#include "../misc.h"
+
+using namespace std;
+
+// GB/s of the misc.h voxel kernels against the plain loops they replace, for every direction:
+// - PermuteImageSlab for each tilt-mhd code, against the naive triple loop over the output (as tilt-mhd had one per
+//   code), for MET_FLOAT and MET_UCHAR;
+// - SwapBytes (big-endian to native, 2, 4 and 8 byte elements) and ReverseElements (rows mirrored along x, 1, 2, 4
+//   and 8 byte elements) as dispatched at run time (AVX2/SSSE3), against their scalar versions.
+// Each kernel result is compared with the plain loop; times are the best of 3 runs, GB/s counts the output bytes.
+//   USAGE: bench-permute-kernels [<edge voxels of the test image, default 256>]
+
+static const int runs = 3;
+static int failures = 0;
+
+template <typename F> double BestSeconds(F f)
+  {
+  double best = DBL_MAX;
+  for (int run = 0; run < runs; run++)
+    {
+    const auto t0 = chrono::steady_clock::now();
+    f();
+    best = min(best, chrono::duration<double>(chrono::steady_clock::now() - t0).count());
+    }
+  return best;
+  }
+
+static void Report(const string &name, uint64_t bytes, double plainSeconds, double kernelSeconds, bool equal)
+  {
+  printf("  %-8s %7.3f s %6.2f GB/s   %7.3f s %6.2f GB/s   %5.1fx%s\n", name.c_str(), plainSeconds,
+         bytes / plainSeconds * 1e-9, kernelSeconds, bytes / kernelSeconds * 1e-9, plainSeconds / kernelSeconds,
+         equal ? "" : "   MISMATCH");
+  if (!equal) failures++;
+  }
+
+// out[z][y][x] = in[base + x * step[0] + y * step[1] + z * step[2]], the loop order of the output
+template <typename T> void NaivePermute(const T *in, intxyz inVoxels, const axisPermutation3D &p, T *out)
+  {
+  const int64_t inDim[3] = { inVoxels.x, inVoxels.y, inVoxels.z }, inStride[3] = { 1, inDim[0], inDim[0] * inDim[1] };
+  int64_t dim[3], step[3], base = 0;
+  for (int a = 0; a < 3; a++)
+    {
+    dim[a]  = inDim[p.axis[a]];
+    step[a] = inStride[p.axis[a]];
+    if (p.flip[a]) { base += (dim[a] - 1) * step[a]; step[a] = -step[a]; }
+    }
+  for (int64_t z = 0; z < dim[2]; z++)
+    for (int64_t y = 0; y < dim[1]; y++)
+      for (int64_t x = 0; x < dim[0]; x++)
+        *out++ = in[base + x * step[0] + y * step[1] + z * step[2]];
+  }
+
+template <typename T> void BenchmarkTilts(int edge, const char *typeName)
+  {
+  const intxyz voxels(edge, edge + 16, edge - 16); // not cubic, so wrong axes would not go unnoticed
+  const size_t n = (size_t)voxels.x * voxels.y * voxels.z;
+  vector<T> in(n), plain(n), kernel(n);
+  for (size_t i = 0; i < n; i++) in[i] = T(i * 2654435761u >> 7);
+  printf("PermuteImageSlab, %d x %d x %d %s      naive loop            PermuteImageSlab\n", voxels.x, voxels.y,
+         voxels.z, typeName);
+  for (const char *code : { "+x", "-x", "+y", "-y", "+z", "-z", "++x", "--x", "++y", "--y", "++z", "--z" })
+    {
+    axisPermutation3D p;
+    string suffix;
+    GetTiltAxisPermutation3D(code, p, suffix);
+    const intxyz outVoxels = PermuteAxes3D(voxels, p);
+    const double plainSeconds  = BestSeconds([&]() { NaivePermute(in.data(), voxels, p, plain.data()); });
+    const double kernelSeconds = BestSeconds([&]()
+      { PermuteImageSlab(in.data(), voxels, p, kernel.data(), 0, outVoxels.z); });
+    Report(code, n * sizeof(T), plainSeconds, kernelSeconds, plain == kernel);
+    }
+  }
+
+template <size_t BYTES> void BenchmarkSwap(size_t n)
+  {
+  vector<uint8_t> in(n * BYTES), plain(n * BYTES), kernel(n * BYTES);
+  for (size_t i = 0; i < in.size(); i++) in[i] = uint8_t(i * 131 + (i >> 9));
+  const double plainSeconds  = BestSeconds([&]() { SwapBytesScalar<BYTES>(in.data(), plain.data(), n); });
+  const double kernelSeconds = BestSeconds([&]() { SwapBytes<BYTES>(in.data(), kernel.data(), n); });
+  Report("swap " + to_string(BYTES), n * BYTES, plainSeconds, kernelSeconds, plain == kernel);
+  }
+
+template <size_t BYTES> void BenchmarkReverse(size_t n, size_t rowVoxels)
+  {
+  vector<uint8_t> plain(n * BYTES), kernel;
+  for (size_t i = 0; i < plain.size(); i++) plain[i] = uint8_t(i * 131 + (i >> 9));
+  kernel = plain;
+  // in place, row by row (as mirror-mhd -x); an even number of runs leaves the data as it was
+  const double plainSeconds = BestSeconds([&]()
+    { for (size_t r = 0; r < n; r += rowVoxels) ReverseElementsScalar<BYTES>(plain.data() + r * BYTES, rowVoxels); });
+  const double kernelSeconds = BestSeconds([&]()
+    { for (size_t r = 0; r < n; r += rowVoxels) ReverseElements<BYTES>(kernel.data() + r * BYTES, rowVoxels); });
+  Report("rev " + to_string(BYTES), n * BYTES, plainSeconds, kernelSeconds, plain == kernel);
+  }
+
+int main(int argc, char *argv[])
+  {
+  const int edge = (argc > 1) ? atoi(argv[1]) : 256;
+  if (edge < 32) ECHO_ERROR("The edge of the test image must be at least 32 voxels");
+  printf("threads: %u, AVX2: %s, SSSE3: %s\n\n", max(1u, thread::hardware_concurrency()),
+         __builtin_cpu_supports("avx2") ? "yes" : "no", __builtin_cpu_supports("ssse3") ? "yes" : "no");
+  BenchmarkTilts<float>(edge, "MET_FLOAT");
+  BenchmarkTilts<uint8_t>(edge, "MET_UCHAR");
+  const size_t bytes = (size_t)edge * edge * edge; // per element size
+  printf("\nbyte swap, reverse (rows of %d), %zu MiB       scalar                dispatched\n", edge,
+         bytes >> 20);
+  BenchmarkSwap<2>(bytes / 2);
+  BenchmarkSwap<4>(bytes / 4);
+  BenchmarkSwap<8>(bytes / 8);
+  BenchmarkReverse<1>(bytes,     edge);
+  BenchmarkReverse<2>(bytes / 2, edge);
+  BenchmarkReverse<4>(bytes / 4, edge);
+  BenchmarkReverse<8>(bytes / 8, edge);
+  if (failures) printf("\nbench-permute-kernels: %d kernels differ from the plain loops\n", failures);
+  return failures ? 1 : 0;
+  }
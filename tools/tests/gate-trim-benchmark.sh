@@ -0,0 +1,64 @@
+#!/bin/bash
+# Gate initialisation time and peak memory of a phantom atlas before and after trim-mhd -c (as musire.sh trims it
+# with PhantomTrim): for each atlas a macro builds the voxelized phantom (ImageNestedParametrisedVolume) with a
+# MuMapActor of the atlas resolution, runs /gate/run/initialize and exits. Needs Gate (in the PATH or given) and
+# python3.
+#   USAGE: gate-trim-benchmark.sh <atlas.mhd> <materials.dat> [<Gate>]
+set -euo pipefail
+(( $# >= 2 )) || { sed -n '2,6p' "$0"; exit 1; }
+toolsDir="$(realpath -- "$(dirname -- "$0")/..")"
+atlasMhdFile="$(realpath -s -- "$1")"
+materialsDatFile="$(realpath -- "$2")"
+gate="${3:-Gate}"
+command -v "$gate" > /dev/null || { echo "gate-trim-benchmark: '$gate' not found"; exit 1; }
+workDir="$(mktemp -d)"
+trap 'rm -rf -- "$workDir"' EXIT
+cd -- "$workDir"
+cp -- "$materialsDatFile" materials.dat
+# the atlas next to the trimmed one (raw data file names are relative to the working directory)
+ln -s -- "$atlasMhdFile" .
+ln -s -- "$(dirname -- "$atlasMhdFile")/$(awk '$1 == "ElementDataFile" { print $3 }' "$atlasMhdFile")" .
+atlasMhdFile="$(basename -- "$atlasMhdFile")"
+
+# trimmed atlas (background labels as in musire.sh)
+backgroundLabels=($(awk 'NR > 1 && $3 ~ /^(Air|Vacuum|G4_AIR|G4_Galactic)$/ { print $1 ":" $2 }' materials.dat))
+(( ${#backgroundLabels[@]} > 0 )) || { echo "gate-trim-benchmark: no Air/Vacuum labels in $2"; exit 1; }
+read -r trimmedMhdFile _ < <("$toolsDir"/trim-mhd -c "$atlasMhdFile" "${backgroundLabels[@]}")
+
+EchoMacro() # <atlas.mhd>
+  {
+  eval "$("$toolsDir"/mhd-info "$1")"
+  echo "/gate/geometry/setMaterialDatabase $toolsDir/../gate/materials/gate-materials.db"
+  echo "/gate/world/geometry/setXLength    3 m"
+  echo "/gate/world/geometry/setYLength    3 m"
+  echo "/gate/world/geometry/setZLength    3 m"
+  echo "/gate/world/setMaterial            Air"
+  echo "/gate/world/daughters/name                      myPhantom"
+  echo "/gate/world/daughters/insert                    ImageNestedParametrisedVolume"
+  echo "/gate/myPhantom/geometry/setImage               $1"
+  echo "/gate/myPhantom/geometry/setRangeToMaterialFile materials.dat"
+  echo "/gate/physics/addPhysicsList          emstandard_opt1"
+  echo "/gate/actor/addActor MuMapActor     getMuMap"
+  echo "/gate/actor/getMuMap/attachTo       myPhantom"
+  echo "/gate/actor/getMuMap/setEnergy      140.51 keV"
+  echo "/gate/actor/getMuMap/setMuUnit      1 1/cm"
+  echo "/gate/actor/getMuMap/save           mumap.mhd"
+  echo "/gate/actor/getMuMap/setResolution  ${DimSize[0]} ${DimSize[1]} ${DimSize[2]}"
+  echo "/gate/actor/getMuMap/setVoxelSize   ${ElementSpacing[0]} ${ElementSpacing[1]} ${ElementSpacing[2]} mm"
+  echo "/gate/run/initialize"
+  echo "exit"
+  }
+
+for mhdFile in "$atlasMhdFile" "$trimmedMhdFile"; do
+  EchoMacro "$mhdFile" > init.mac
+  eval "$("$toolsDir"/mhd-info "$mhdFile")"
+  python3 - "$gate" "${DimSize[@]}" "$(basename -- "$mhdFile")" <<'EOF'
+import resource, subprocess, sys, time
+t0 = time.time()
+subprocess.run([sys.argv[1], 'init.mac'], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, check=True)
+seconds, peakMiB = time.time() - t0, resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss / 1024
+voxels = int(sys.argv[2]) * int(sys.argv[3]) * int(sys.argv[4])
+print(f'{sys.argv[5]}: {sys.argv[2]}x{sys.argv[3]}x{sys.argv[4]} = {voxels} voxels, '
+      f'initialisation {seconds:.1f} s, peak memory {peakMiB:.0f} MiB')
+EOF
+done
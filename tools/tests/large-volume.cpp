@@ -0,0 +1,130 @@
+#include "../misc.h"
+
+using namespace std;
+
+// Writes and re-reads a synthetic 2048 x 1024 x 768 MET_FLOAT volume (6 GiB, beyond 2^31 and 2^32 bytes) through
+// the misc.h I/O layer: the slab writer and reader over the whole volume, the memory-mapped view and a zero-copy
+// header (HeaderSize > 4 GiB) on the last slab, and WriteMhd3DImage() from an image whose untouched pages are zero.
+// The files are written into the working directory (or <dir>) and removed at the end.
+//   USAGE: large-volume [<dir>]
+
+static const intxyz voxels(2048, 1024, 768);
+static int failures = 0;
+
+static float Value(int z, int y, int x) { return float((x + 3 * y + 7 * z) % 1021); }
+
+static void Check(const string &description, bool ok)
+  {
+  cout << (ok ? "ok   " : "FAIL ") << description << endl;
+  if (!ok) failures++;
+  }
+
+// voxels of the slab [z0, z0 + slices) of reader-like slabs that differ from Value()
+static uint64_t Mismatches(const float *slab, int z0, int slices)
+  {
+  uint64_t mismatches = 0;
+  for (int z = 0; z < slices; z++)
+    for (int y = 0; y < voxels.y; y++)
+      {
+      const float *row = slab + ((size_t)z * voxels.y + y) * voxels.x;
+      for (int x = 0; x < voxels.x; x++) mismatches += (row[x] != Value(z0 + z, y, x));
+      }
+  return mismatches;
+  }
+
+int main(int argc, char *argv[])
+  {
+  const filesystem::path dir = (argc > 1) ? argv[1] : ".";
+  mhdHdr3D hdr;
+  hdr.filenameMhd = (dir / "large-volume.mhd").string();
+  hdr.filenameRaw = (dir / "large-volume.raw").string();
+  hdr.voxels      = voxels;
+  hdr.voxelSize   = doublexyz(1.0);
+  hdr.modality    = "MET_MOD_OTHER";
+  hdr.elementType = MET_FLOAT;
+  const uint64_t numberOfBytes = GetNumberOfBytes3D(voxels, sizeof(float));
+  const size_t   sliceVoxels   = (size_t)voxels.x * voxels.y;
+  const int      slabHeight    = GetSlabHeight<float>(hdr);
+
+  // 1. Slab writer
+  {
+  MhdSlabWriter3D<float> writer(hdr);
+  for (int z0 = 0; z0 < voxels.z; z0 += slabHeight)
+    {
+    const int slices = min(slabHeight, voxels.z - z0);
+    vector<float> slab = writer.acquire();
+    slab.resize(slices * sliceVoxels);
+    ParallelFor(0, slices, [&](size_t z)
+      {
+      for (int y = 0; y < voxels.y; y++)
+        for (int x = 0; x < voxels.x; x++) slab[(z * voxels.y + y) * voxels.x + x] = Value(z0 + z, y, x);
+      });
+    writer.write(std::move(slab));
+    }
+  writer.close();
+  }
+  Check("MhdSlabWriter3D writes " + to_string(numberOfBytes) + " bytes",
+        filesystem::file_size(hdr.filenameRaw) == numberOfBytes);
+
+  // 2. Slab reader over the whole volume
+  {
+  const mhdHdr3D readHdr = ReadMhdHeader3D(hdr.filenameMhd);
+  MhdSlabReader3D<float> reader(readHdr, slabHeight);
+  uint64_t mismatches = 0, slices = 0;
+  while (reader.next())
+    {
+    mismatches += Mismatches(reader.slab().data(), reader.z0(), reader.slices());
+    slices     += reader.slices();
+    }
+  Check("MhdSlabReader3D re-reads all slices", mismatches == 0 && slices == (uint64_t)voxels.z);
+  }
+
+  // 3. Memory-mapped view: the last slab lies beyond 4 GiB
+  {
+  const mhdHdr3D readHdr = ReadMhdHeader3D(hdr.filenameMhd);
+  MhdImageView3D<float> view(readHdr);
+  const int z0 = voxels.z - slabHeight;
+  Check("MhdImageView3D last slab", Mismatches(&view.image()[z0][0][0], z0, slabHeight) == 0);
+  }
+
+  // 4. Zero-copy header of the last slab (HeaderSize > 4 GiB), read by the slab reader
+  {
+  const mhdHdr3D readHdr = ReadMhdHeader3D(hdr.filenameMhd);
+  const int z0 = voxels.z - slabHeight;
+  mhdHdr3D cropHdr;
+  cropHdr.filenameMhd = (dir / "large-volume-cropped.mhd").string();
+  GetZeroCopyCroppedMhdHdr3D(readHdr, { intxyz(0, 0, z0), voxels - intxyz(1) }, cropHdr);
+  WriteMhdHeader3D(cropHdr);
+  MhdSlabReader3D<float> reader(ReadMhdHeader3D(cropHdr.filenameMhd), slabHeight);
+  Check("zero-copy header of the last slab (HeaderSize " + to_string(cropHdr.headerSize) + ")",
+        reader.next() && reader.slices() == slabHeight && Mismatches(reader.slab().data(), z0, slabHeight) == 0);
+  filesystem::remove(cropHdr.filenameMhd);
+  }
+  filesystem::remove(hdr.filenameRaw);
+
+  // 5. WriteMhd3DImage() of a whole image in anonymous memory: only its last slice is touched, the other pages are
+  //    zero and not resident
+  {
+  void *memory = mmap(nullptr, numberOfBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                      -1, 0);
+  if (memory == MAP_FAILED) ECHO_ERROR("Could not map %llu bytes", (unsigned long long)numberOfBytes);
+  rarray<float,3> image(static_cast<float*>(memory), voxels.z, voxels.y, voxels.x);
+  for (int y = 0; y < voxels.y; y++)
+    for (int x = 0; x < voxels.x; x++) image[voxels.z - 1][y][x] = Value(voxels.z - 1, y, x);
+  WriteMhd3DImage(hdr, image);
+  munmap(memory, numberOfBytes);
+  }
+  Check("WriteMhd3DImage writes " + to_string(numberOfBytes) + " bytes",
+        filesystem::file_size(hdr.filenameRaw) == numberOfBytes);
+  {
+  const mhdHdr3D readHdr = ReadMhdHeader3D(hdr.filenameMhd);
+  MhdImageView3D<float> view(readHdr);
+  Check("WriteMhd3DImage last slice", Mismatches(&view.image()[voxels.z - 1][0][0], voxels.z - 1, 1) == 0 &&
+                                      view.image()[voxels.z / 2][voxels.y / 2][voxels.x / 2] == 0.0f);
+  }
+  filesystem::remove(hdr.filenameRaw);
+  filesystem::remove(hdr.filenameMhd);
+
+  cout << "large-volume: " << (failures ? to_string(failures) + " failed" : "all checks passed") << endl;
+  return failures ? 1 : 0;
+  }
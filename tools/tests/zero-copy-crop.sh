@@ -0,0 +1,68 @@
+#!/bin/bash
+# Round trip of the zero-copy headers of crop-mhd (z-ranges starting at z = 0, in the middle and at the end) and of
+# trim-mhd: each header is read back by a misc.h reader (a copying crop-mhd -c) and compared with the input slices.
+#   USAGE: zero-copy-crop.sh [<toolsDir>]
+set -euo pipefail
+toolsDir="$(realpath -- "${1:-$(dirname -- "$0")/..}")"
+workDir="$(mktemp -d)"
+trap 'rm -rf -- "$workDir"' EXIT
+cd -- "$workDir"
+failures=0
+
+Check() # <description> <command ...>
+  {
+  local description="$1"; shift
+  if "$@"; then echo "ok   $description"; else echo "FAIL $description"; failures=$((failures + 1)); fi
+  }
+
+# <mhd> equals the z-slices [<zMin>, <zMax>] of p.raw, read back through misc.h
+SlicesMatch() # <mhd> <zMin> <zMax>
+  {
+  local copy copyRaw status=0
+  copy="$("$toolsDir"/crop-mhd "$1" -c)" || return 1
+  copyRaw="$(awk '$1 == "ElementDataFile" { print $3 }' "$copy")"
+  python3 - "$copyRaw" "$2" "$3" <<'EOF' || status=1
+import sys
+sliceBytes = 16 * 12 * 2
+raw = open('p.raw', 'rb').read()
+sys.exit(open(sys.argv[1], 'rb').read() != raw[int(sys.argv[2]) * sliceBytes:(int(sys.argv[3]) + 1) * sliceBytes])
+EOF
+  rm -f -- "$copy" "$copyRaw"
+  return $status
+  }
+
+# 16 x 12 x 20 MET_USHORT atlas: label z + 1 in the slices [0, 13], background 0 above
+python3 - <<'EOF'
+import array
+a = array.array('H', [z + 1 if z <= 13 else 0 for z in range(20) for y in range(12) for x in range(16)])
+open('p.raw', 'wb').write(a.tobytes())
+open('p.mhd', 'w').write('ObjectType = Image\nNDims = 3\nDimSize = 16 12 20\nElementType = MET_USHORT\n'
+                         'ElementSpacing = 1 1 2\nElementDataFile = p.raw\n')
+EOF
+
+for range in 0:9 :9 5:12 12: 0:19; do
+  zMin=${range%:*}; zMax=${range#*:}
+  "$toolsDir"/crop-mhd p.mhd "z=$range" > /dev/null
+  Check "crop-mhd z=$range writes a header only" test ! -e p-cropped.raw
+  Check "crop-mhd z=$range reads back" SlicesMatch p-cropped.mhd "${zMin:-0}" "${zMax:-19}"
+done
+
+# the Offset of a box is the world position of its first voxel (ElementSpacing 1 1 2)
+"$toolsDir"/crop-mhd p.mhd x=3: y=2:9 z=5:12 > /dev/null
+Check "crop-mhd x=3: y=2:9 z=5:12 moves the Offset" grep -qx "Offset = 3 2 10" p-cropped.mhd
+"$toolsDir"/crop-mhd p.mhd z=5:12 > /dev/null
+Check "crop-mhd z=5:12 moves the Offset" grep -qx "Offset = 0 0 10" p-cropped.mhd
+
+# trim-mhd: the foreground boxes are z-ranges, so the trimmed headers are zero copy too
+TrimChecks() # <zMin> <zMax> <trim-mhd arguments ...>
+  {
+  local zMin="$1" zMax="$2"; shift 2
+  "$toolsDir"/trim-mhd "$@" > /dev/null
+  Check "trim-mhd $* writes a header only" test ! -e p-trimmed.raw
+  Check "trim-mhd $* reads back" SlicesMatch p-trimmed.mhd "$zMin" "$zMax"
+  }
+TrimChecks 0 13 p.mhd         # box from z = 0
+TrimChecks 5 13 p.mhd 0 1:5   # box in the middle
+TrimChecks 0 19 -c p.mhd      # centred: the full image
+
+(( failures == 0 )) && echo "zero-copy-crop: all checks passed" || { echo "zero-copy-crop: $failures failed"; exit 1; }
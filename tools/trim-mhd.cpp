@@ -0,0 +1,84 @@
+#include "misc.h"
+
+using namespace std;
+
+// box of the voxels whose value is in none of the background ranges
+template <typename T> voxelBox3D GetPhantomBox(const mhdHdr3D &hdr, const vector<pair<double,double>> &background)
+  {
+  MhdImageView3D<T> view(hdr);
+  auto inBackground = [&](double value)
+    {
+    for (const auto &range : background)
+      if (range.first <= value && value <= range.second) return true;
+    return false;
+    };
+  if constexpr (is_integral<T>::value && sizeof(T) <= 2)
+    { // labels: one table lookup per voxel
+    vector<uint8_t> lut(size_t(1) << (8 * sizeof(T)));
+    for (size_t i = 0; i < lut.size(); i++) lut[i] = inBackground(double(numeric_limits<T>::lowest()) + i);
+    return GetForegroundBox3D(view.image().data(), hdr.voxels, 
+                              [&](T value) { return lut[size_t(value - numeric_limits<T>::lowest())] != 0; });
+    }
+  else
+    return GetForegroundBox3D(view.image().data(), hdr.voxels, [&](T value) { return inBackground(value); });
+  }
+
+int main(int argc, char *argv[])
+  {
+  const bool centred = (argc > 1 && strcmp("-c", argv[1]) == 0);
+  const int  first   = centred ? 2 : 1; // input file argument
+  if (argc < first + 1)
+    ECHO_ERROR("$ trim-mhd [-c] <in.mhd> [<label>|<min>:<max> ...]\n"
+               "  Crops the image to the box of its voxels that are not background (default label 0, otherwise the\n"
+               "  given labels and label ranges, e.g. the air labels of a phantom) into <in>-trimmed.mhd. With -c\n"
+               "  the box is widened to be centred on the image centre. Prints the output file name and the\n"
+               "  position (mm) of the trimmed image centre relative to the input image centre, i.e. the\n"
+               "  translation that keeps the phantom in place (0 0 0 with -c).");
+  const string inMhdFilename = argv[first];
+  if (!filesystem::exists(inMhdFilename))
+    ECHO_ERROR("'%s' does not exist", inMhdFilename.c_str());
+  const mhdHdr3D inHdr = ReadMhdHeader3D(inMhdFilename);
+  if (inHdr.transformMatrix != mhdHdr3D().transformMatrix)
+    ECHO_ERROR("'%s' has a TransformMatrix, materialize it first (orient-mhd -m)", inMhdFilename.c_str());
+  vector<pair<double,double>> background;
+  for (int i = first + 1; i < argc; i++)
+    {
+    const string arg = argv[i];
+    const size_t colon = arg.find(':');
+    try
+      {
+      if (colon == string::npos) background.push_back({ stod(arg), stod(arg) });
+      else                       background.push_back({ stod(arg.substr(0, colon)), stod(arg.substr(colon + 1)) });
+      }
+    catch (const exception &) { ECHO_ERROR("trim-mhd: invalid background label(s) '%s'", argv[i]); }
+    }
+  if (background.empty()) background.push_back({ 0, 0 });
+
+  // 1. Box of the foreground (one parallel pass)
+  voxelBox3D box = VisitElementType(inHdr.elementType, [&](auto tag)
+    { return GetPhantomBox<typename decltype(tag)::type>(inHdr, background); });
+  if (box.min.x > box.max.x)
+    ECHO_ERROR("'%s' contains only background", inMhdFilename.c_str());
+  if (centred)
+    for (int a = 0; a < 3; a++)
+      {
+      const int margin = min(box.min[a], inHdr.voxels[a] - 1 - box.max[a]);
+      box.min[a] = margin;
+      box.max[a] = inHdr.voxels[a] - 1 - margin;
+      }
+
+  // 2. Crop (zero copy for a z-range, see crop-mhd)
+  mhdHdr3D outHdr = GetDerivedMhdHdr3D(inHdr, "-trimmed");
+  if (!GetZeroCopyCroppedMhdHdr3D(inHdr, box, outHdr))
+    VisitElementType(inHdr.elementType, [&](auto tag) 
+      { WriteCroppedImage3D<typename decltype(tag)::type>(inHdr, box, outHdr); });
+  else
+    WriteMhdHeader3D(outHdr);
+
+  // the following string is used in musire.sh
+  doublexyz shift;
+  for (int a = 0; a < 3; a++)
+    shift[a] = 0.5 * (box.min[a] + box.max[a] - (inHdr.voxels[a] - 1)) * inHdr.voxelSize[a];
+  cout << outHdr.filenameMhd << " " << shift.x << " " << shift.y << " " << shift.z << endl;
+  return 0;
+  }